@@ -0,0 +1,32 @@
+
+#pragma once
+
+#include "formats.hpp"
+#include <cstddef>
+
+namespace druck::blending {
+
+    using druck::rendering::Color;
+    using druck::math::Vec;
+
+
+    // How a new color ('src') is combined with the one already stored
+    // ('dest'), with 'src_a' being the alpha of the new color:
+    enum Mode {
+        REPLACE, // src
+        ALPHA, // rgb: src * src_a + dest * (1 - src_a),
+               // a: src_a + dest_a * (1 - src_a)
+        PREMULTIPLIED, // src + dest * (1 - src_a) (src rgb is premultiplied)
+        ADDITIVE, // rgb: dest + src * src_a, a: dest_a + src_a
+        MULTIPLY // rgb: src * dest, a: dest_a
+    };
+
+    // Blends 'count' colors from 'src' onto the ones in 'dest', in place.
+    // Results are saturated to [0, 1].
+    void blend_rgba8(Mode mode, const Color* src, Color* dest, size_t count);
+    // Same as above for RGBA float quadruples ('4 * count' floats each),
+    // without saturating
+    void blend_floats(Mode mode, const float* src, float* dest, size_t count);
+    Vec<4> blend(Mode mode, const Vec<4>& src, const Vec<4>& dest);
+
+}
@@ -0,0 +1,33 @@
+
+#pragma once
+
+#include "rendering.hpp"
+
+namespace druck::blit {
+
+    namespace rendering = druck::rendering;
+
+
+    enum Filter {
+        NEAREST, BILINEAR
+    };
+
+    // Copies all of 'src' into the given rectangle of 'dest', scaling it to
+    // fit (the rectangle may exceed the bounds of 'dest').
+    // If 'alpha_blend' is true, the source is blended over the destination
+    // based on its alpha instead of replacing it.
+    void scaled(
+        const rendering::Surface& src, rendering::Surface& dest,
+        int dest_x, int dest_y, int dest_width, int dest_height,
+        Filter filter = Filter::NEAREST, bool alpha_blend = false
+    );
+
+    // Same as above, but only the pixels of 'dest' inside 'region' are written
+    void scaled(
+        const rendering::Surface& src, rendering::Surface& dest,
+        int dest_x, int dest_y, int dest_width, int dest_height,
+        const rendering::Rect& region,
+        Filter filter = Filter::NEAREST, bool alpha_blend = false
+    );
+
+}
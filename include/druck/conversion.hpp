@@ -0,0 +1,36 @@
+
+#pragma once
+
+#include "formats.hpp"
+#include <cstddef>
+
+namespace druck::conversion {
+
+    using druck::rendering::Color;
+
+
+    // Batched conversions between RGBA float quadruples ('src'/'dest'
+    // containing '4 * count' floats) and RGBA8.
+    // Packing saturates each channel to [0, 1] and rounds to the nearest value.
+    void pack_rgba8(const float* src, Color* dest, size_t count);
+    void unpack_rgba8(const Color* src, float* dest, size_t count);
+
+    // Same as above, but the RGB channels are encoded to / decoded from sRGB
+    // using lookup tables (alpha is always linear).
+    void pack_srgb8(const float* src, Color* dest, size_t count);
+    void unpack_srgb8(const Color* src, float* dest, size_t count);
+
+    // Single value versions of the above, using the same lookup tables
+    float unorm8_to_float(uint8_t value);
+    float srgb8_to_float(uint8_t value);
+    uint8_t float_to_srgb8(float value);
+
+    // Converts RGBA8 pixels to planar YUV 4:2:0 (BT.601, limited range,
+    // alpha is dropped). Chroma is the average of each 2x2 block, so 'u' and
+    // 'v' need to hold '((width + 1) / 2) * ((height + 1) / 2)' values each.
+    void rgba8_to_yuv420(
+        const Color* src, int width, int height,
+        uint8_t* y, uint8_t* u, uint8_t* v
+    );
+
+}
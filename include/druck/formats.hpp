@@ -0,0 +1,326 @@
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "math.hpp"
+
+
+namespace druck::rendering {
+
+    using namespace druck::math;
+
+
+    struct Color {
+        uint8_t r;
+        uint8_t g;
+        uint8_t b;
+        uint8_t a;
+
+        static uint8_t channel_from_float(double value) {
+            // (also maps NaN to 0, without 'std::isnan', which fast math
+            // options may assume to always be false)
+            value = value > 0.0 ? value : 0.0;
+            return static_cast<uint8_t>(std::min(value, 1.0) * 255.0 + 0.5);
+        }
+
+        static Color from_floats(const Vec<4>& color) {
+            return {
+                channel_from_float(color.r()),
+                channel_from_float(color.g()),
+                channel_from_float(color.b()),
+                channel_from_float(color.a())
+            };
+        }
+
+        Vec<4> to_floats() const {
+            return Vec<4>(
+                this->r / 255.0, this->g / 255.0, 
+                this->b / 255.0, this->a / 255.0
+            );
+        }
+    };
+
+
+    static uint16_t float_to_half(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(float));
+        uint16_t sign = (bits >> 16) & 0x8000;
+        int32_t exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+        uint32_t mantissa = bits & 0x7FFFFF;
+        if(((bits >> 23) & 0xFF) == 0xFF) {
+            // infinity or NaN
+            return sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0);
+        }
+        if(exponent >= 31) { return sign | 0x7C00; } // overflow
+        if(exponent <= 0) {
+            // subnormal (or too small to be represented at all)
+            if(exponent < -10) { return sign; }
+            mantissa = (mantissa | 0x800000) >> (1 - exponent);
+            return sign | ((mantissa + 0x1000) >> 13);
+        }
+        uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+        // round to nearest (may carry into the exponent, which is correct)
+        if(mantissa & 0x1000) { half += 1; }
+        return half;
+    }
+
+    static float half_to_float(uint16_t half) {
+        uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+        uint32_t exponent = (half >> 10) & 0x1F;
+        uint32_t mantissa = half & 0x3FF;
+        uint32_t bits;
+        if(exponent == 0x1F) {
+            bits = sign | 0x7F800000 | (mantissa << 13);
+        } else if(exponent != 0) {
+            bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        } else if(mantissa == 0) {
+            bits = sign;
+        } else {
+            // normalize the subnormal value
+            exponent = 127 - 15 + 1;
+            while((mantissa & 0x400) == 0) {
+                mantissa <<= 1;
+                exponent -= 1;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+        }
+        float value;
+        std::memcpy(&value, &bits, sizeof(float));
+        return value;
+    }
+
+
+    // Pixels are always encoded from and decoded to RGBA vectors.
+    // 'R8' only stores the red channel and replicates it into RGB when decoded
+    // (alpha is always 1), which makes masks display as grayscale.
+    enum PixelFormat {
+        RGBA8, RGB565, R8, RGBA16F, RGBA32F
+    };
+
+    template<PixelFormat F>
+    struct PixelTraits {};
+
+    template<>
+    struct PixelTraits<PixelFormat::RGBA8> {
+        using Stored = Color;
+        static constexpr Stored cleared = { 0, 0, 0, 255 };
+
+        static Stored encode(const Vec<4>& color) {
+            return Color::from_floats(color);
+        }
+        static Vec<4> decode(Stored stored) { return stored.to_floats(); }
+    };
+
+    template<>
+    struct PixelTraits<PixelFormat::RGB565> {
+        using Stored = uint16_t;
+        static constexpr Stored cleared = 0;
+
+        static Stored encode(const Vec<4>& color) {
+            // values need to be clamped so that they can't overflow into
+            // the neighbouring channel
+            uint16_t r = (uint16_t) (std::clamp(color.r(), 0.0, 1.0) * 31.0);
+            uint16_t g = (uint16_t) (std::clamp(color.g(), 0.0, 1.0) * 63.0);
+            uint16_t b = (uint16_t) (std::clamp(color.b(), 0.0, 1.0) * 31.0);
+            return (uint16_t) ((r << 11) | (g << 5) | b);
+        }
+        static Vec<4> decode(Stored stored) {
+            return Vec<4>(
+                ((stored >> 11) & 0x1F) / 31.0,
+                ((stored >> 5) & 0x3F) / 63.0,
+                (stored & 0x1F) / 31.0,
+                1.0
+            );
+        }
+    };
+
+    template<>
+    struct PixelTraits<PixelFormat::R8> {
+        using Stored = uint8_t;
+        static constexpr Stored cleared = 0;
+
+        static Stored encode(const Vec<4>& color) {
+            return Color::channel_from_float(color.r());
+        }
+        static Vec<4> decode(Stored stored) {
+            double value = stored / 255.0;
+            return Vec<4>(value, value, value, 1.0);
+        }
+    };
+
+    struct HalfColor {
+        uint16_t r;
+        uint16_t g;
+        uint16_t b;
+        uint16_t a;
+    };
+
+    template<>
+    struct PixelTraits<PixelFormat::RGBA16F> {
+        using Stored = HalfColor;
+        static constexpr Stored cleared = { 0x0000, 0x0000, 0x0000, 0x3C00 };
+
+        static Stored encode(const Vec<4>& color) {
+            return {
+                float_to_half((float) color.r()), 
+                float_to_half((float) color.g()),
+                float_to_half((float) color.b()), 
+                float_to_half((float) color.a())
+            };
+        }
+        static Vec<4> decode(Stored stored) {
+            return Vec<4>(
+                half_to_float(stored.r), half_to_float(stored.g),
+                half_to_float(stored.b), half_to_float(stored.a)
+            );
+        }
+    };
+
+    struct FloatColor {
+        float r;
+        float g;
+        float b;
+        float a;
+    };
+
+    template<>
+    struct PixelTraits<PixelFormat::RGBA32F> {
+        using Stored = FloatColor;
+        static constexpr Stored cleared = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+        static Stored encode(const Vec<4>& color) {
+            return {
+                (float) color.r(), (float) color.g(), 
+                (float) color.b(), (float) color.a()
+            };
+        }
+        static Vec<4> decode(Stored stored) {
+            return Vec<4>(stored.r, stored.g, stored.b, stored.a);
+        }
+    };
+
+    inline size_t pixel_format_size(PixelFormat format) {
+        switch(format) {
+            case PixelFormat::RGBA8: return sizeof(Color);
+            case PixelFormat::RGB565: return sizeof(uint16_t);
+            case PixelFormat::R8: return sizeof(uint8_t);
+            case PixelFormat::RGBA16F: return sizeof(HalfColor);
+            case PixelFormat::RGBA32F: return sizeof(FloatColor);
+        }
+        return 0;
+    }
+
+    // Calls 'f.template operator()<F>()' with 'F' being the given format
+    // as a compile time constant, e.g.
+    // 'dispatch_pixel_format(format, [&]<PixelFormat F>() { ... })'
+    template<typename Fn>
+    decltype(auto) dispatch_pixel_format(PixelFormat format, Fn&& f) {
+        switch(format) {
+            case PixelFormat::RGBA8:
+                return f.template operator()<PixelFormat::RGBA8>();
+            case PixelFormat::RGB565:
+                return f.template operator()<PixelFormat::RGB565>();
+            case PixelFormat::R8:
+                return f.template operator()<PixelFormat::R8>();
+            case PixelFormat::RGBA16F:
+                return f.template operator()<PixelFormat::RGBA16F>();
+            case PixelFormat::RGBA32F:
+                return f.template operator()<PixelFormat::RGBA32F>();
+        }
+        std::abort(); // should be unreachable
+    }
+
+    // Depth values are stored in window space, meaning that 0 is the near
+    // plane and 1 is the far plane (with the exception of 'REVERSE_FLOAT32',
+    // which stores '1 - depth' to make better use of float precision)
+    enum DepthFormat {
+        FLOAT32, REVERSE_FLOAT32, UNORM24, UNORM16
+    };
+
+    template<DepthFormat F>
+    struct DepthTraits {};
+
+    template<>
+    struct DepthTraits<DepthFormat::FLOAT32> {
+        using Stored = float;
+        static constexpr Stored cleared = 1.0f;
+
+        static Stored encode(double depth) { return (float) depth; }
+        static double decode(Stored stored) { return stored; }
+        static bool passes(Stored fragment, Stored stored) {
+            return fragment < stored;
+        }
+    };
+
+    template<>
+    struct DepthTraits<DepthFormat::REVERSE_FLOAT32> {
+        using Stored = float;
+        static constexpr Stored cleared = 0.0f;
+
+        static Stored encode(double depth) { return (float) (1.0 - depth); }
+        static double decode(Stored stored) { return 1.0 - stored; }
+        static bool passes(Stored fragment, Stored stored) {
+            return fragment > stored;
+        }
+    };
+
+    template<>
+    struct DepthTraits<DepthFormat::UNORM24> {
+        // the upper 8 bits are always 0
+        using Stored = uint32_t;
+        static constexpr Stored cleared = 0xFFFFFF;
+
+        static Stored encode(double depth) {
+            return (uint32_t) (depth * 16777215.0 + 0.5);
+        }
+        static double decode(Stored stored) { return stored / 16777215.0; }
+        static bool passes(Stored fragment, Stored stored) {
+            return fragment < stored;
+        }
+    };
+
+    template<>
+    struct DepthTraits<DepthFormat::UNORM16> {
+        using Stored = uint16_t;
+        static constexpr Stored cleared = 0xFFFF;
+
+        static Stored encode(double depth) {
+            return (uint16_t) (depth * 65535.0 + 0.5);
+        }
+        static double decode(Stored stored) { return stored / 65535.0; }
+        static bool passes(Stored fragment, Stored stored) {
+            return fragment < stored;
+        }
+    };
+
+    inline size_t depth_format_size(DepthFormat format) {
+        switch(format) {
+            case DepthFormat::FLOAT32: return sizeof(float);
+            case DepthFormat::REVERSE_FLOAT32: return sizeof(float);
+            case DepthFormat::UNORM24: return sizeof(uint32_t);
+            case DepthFormat::UNORM16: return sizeof(uint16_t);
+        }
+        return 0;
+    }
+
+    // Same as 'dispatch_pixel_format', but for depth formats
+    template<typename Fn>
+    decltype(auto) dispatch_depth_format(DepthFormat format, Fn&& f) {
+        switch(format) {
+            case DepthFormat::FLOAT32:
+                return f.template operator()<DepthFormat::FLOAT32>();
+            case DepthFormat::REVERSE_FLOAT32:
+                return f.template operator()<DepthFormat::REVERSE_FLOAT32>();
+            case DepthFormat::UNORM24:
+                return f.template operator()<DepthFormat::UNORM24>();
+            case DepthFormat::UNORM16:
+                return f.template operator()<DepthFormat::UNORM16>();
+        }
+        std::abort(); // should be unreachable
+    }
+
+}
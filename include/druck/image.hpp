@@ -0,0 +1,91 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+
+namespace druck::image {
+
+    namespace rendering = druck::rendering;
+
+
+    // Encode RGBA8 pixels as a binary PPM ('P6', alpha is dropped)
+    // or as an 8-bit RGBA PNG
+    std::vector<uint8_t> encode_ppm(
+        const rendering::Color* pixels, int width, int height
+    );
+    std::vector<uint8_t> encode_png(
+        const rendering::Color* pixels, int width, int height
+    );
+
+    // Same as above, with the surface converted to RGBA8 first
+    std::vector<uint8_t> encode_ppm(const rendering::Surface& surface);
+    std::vector<uint8_t> encode_png(const rendering::Surface& surface);
+
+    void write_file(const std::string& file, const std::vector<uint8_t>& data);
+
+    // Decodes a PNG (non-interlaced, 8 or 16 bits per channel) or a binary
+    // PPM ('P6') into an RGBA8 surface without a depth buffer.
+    // 'name' is only used for error messages.
+    rendering::Surface decode(
+        const std::vector<uint8_t>& data, const std::string& name
+    );
+    rendering::Surface read_image(const char* file);
+
+
+
+    // Encodes and writes PNG files on a separate thread. Saving only copies
+    // the surface (into a reused buffer), and at most 'max_queued' copies
+    // wait at once - further saves are rejected instead of blocking.
+    struct Writer {
+        Writer(size_t max_queued = 4);
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer& other) = delete;
+        // Writes all queued snapshots before returning
+        ~Writer();
+
+        // The result is true if the file was written, and false if it
+        // could not be written or the queue was full
+        std::future<bool> save_png(
+            const rendering::Surface& surface, std::string file
+        );
+        // Same as above, but 'done' is called with the result instead
+        // (on the writer thread, or immediately if the queue was full)
+        void save_png(
+            const rendering::Surface& surface, std::string file,
+            std::function<void(bool)> done
+        );
+        size_t queued();
+
+        private:
+        struct Snapshot {
+            std::vector<rendering::Color> pixels;
+            int width;
+            int height;
+            std::string file;
+            std::function<void(bool)> done;
+        };
+
+        size_t max_queued;
+        std::vector<std::vector<rendering::Color>> free_buffers;
+        std::deque<Snapshot> queue;
+        // snapshots that have passed the queue limit but are still being
+        // copied (and not in 'queue' yet)
+        size_t reserved = 0;
+        bool writing = false;
+        bool stopping = false;
+        std::mutex lock;
+        std::condition_variable snapshot_queued;
+        std::thread thread;
+
+        void run();
+    };
+
+}
@@ -2,6 +2,7 @@
 #pragma once
 
 #include <string>
+#include <cstdarg>
 
 namespace druck::logging {
 
@@ -508,6 +508,47 @@ namespace druck::math {
             return sum;
         }
 
+        // The inverse of the matrix, which needs to be invertible
+        Mat<R, C> inverse() const {
+            static_assert(R == C, "Must be a square matrix!");
+            Mat<R, C> reduced = *this;
+            Mat<R, C> inverse = Mat<R, C>();
+            auto swap_rows = [](Mat<R, C>& m, int a, int b) {
+                for(int column_i = 0; column_i < C; column_i += 1) {
+                    std::swap(m.element(a, column_i), m.element(b, column_i));
+                }
+            };
+            // Gauss-Jordan elimination with partial pivoting
+            for(int pivot_i = 0; pivot_i < R; pivot_i += 1) {
+                int largest = pivot_i;
+                for(int row_i = pivot_i + 1; row_i < R; row_i += 1) {
+                    if(fabs(reduced.element(row_i, pivot_i))
+                        > fabs(reduced.element(largest, pivot_i))) {
+                        largest = row_i;
+                    }
+                }
+                swap_rows(reduced, pivot_i, largest);
+                swap_rows(inverse, pivot_i, largest);
+                double factor = 1.0 / reduced.element(pivot_i, pivot_i);
+                for(int column_i = 0; column_i < C; column_i += 1) {
+                    reduced.element(pivot_i, column_i) *= factor;
+                    inverse.element(pivot_i, column_i) *= factor;
+                }
+                for(int row_i = 0; row_i < R; row_i += 1) {
+                    if(row_i == pivot_i) { continue; }
+                    double scale = reduced.element(row_i, pivot_i);
+                    if(scale == 0.0) { continue; }
+                    for(int column_i = 0; column_i < C; column_i += 1) {
+                        reduced.element(row_i, column_i)
+                            -= reduced.element(pivot_i, column_i) * scale;
+                        inverse.element(row_i, column_i)
+                            -= inverse.element(pivot_i, column_i) * scale;
+                    }
+                }
+            }
+            return inverse;
+        }
+
     };
 
 
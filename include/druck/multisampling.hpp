@@ -0,0 +1,231 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include <cstdint>
+
+namespace druck::rendering {
+
+    #define MULTISAMPLE_MAX_SAMPLES 4
+
+    // The positions of the samples in a pixel for the given sample count
+    // (1, 2 or 4), relative to the position the rasterizer uses for the
+    // pixel (in pixels)
+    const Vec<2>* multisample_positions(int sample_count);
+
+    // A surface storing color and depth for multiple samples per pixel
+    // (multisample anti-aliasing). Coverage and depth are determined for
+    // each sample, but 'fragment' is only run once per pixel and triangle,
+    // with the result written to all covered samples that pass the depth
+    // test. 'resolve' averages the samples into a normal surface.
+    struct MultisampleSurface {
+        int sample_count;
+        // the samples of pixel (x, y) are stored at
+        // (x * sample_count + i, y), so this is 'sample_count' times wider
+        Surface samples;
+
+        MultisampleSurface(
+            int width, int height, int sample_count,
+            PixelFormat format = PixelFormat::RGBA8,
+            DepthFormat depth_format = DepthFormat::FLOAT32
+        );
+
+        int width() const;
+        int height() const;
+
+        void resize(int width, int height);
+        void clear();
+
+        // Multisampling always shades once per pixel, so the shading rate
+        // and pixel pattern of 'state' need to be left at their defaults
+        template<typename V, typename S>
+        void draw_mesh(
+            const Mesh<V>& mesh, S& shader,
+            const DrawState& state = DrawState()
+        ) {
+            static_assert(std::is_base_of<Shader<V, S>, S>(), "Must be a shader!");
+            static_assert(std::is_copy_constructible<S>(), "Must be copyable!");
+            this->verify_draw_state(state);
+            int width = this->width();
+            int height = this->height();
+            ShadedTriangle<V, S> triangle;
+            VertexCache<V, S> cache(mesh, shader);
+            for(size_t elem_i = 0; elem_i < mesh.elements.size(); elem_i += 1) {
+                bool visible = cache.shade_triangle(
+                    elem_i, width, height, triangle
+                );
+                if(!visible) { continue; }
+                Rect area = triangle_bounds(triangle, width, height);
+                if(area.is_empty()) { continue; }
+                this->samples.mark_dirty({
+                    area.x * this->sample_count, area.y,
+                    area.width * this->sample_count, area.height
+                });
+                this->drawn = this->drawn.united(area);
+                this->unresolved = this->unresolved.united(area);
+                shader.set_vertex_states(&triangle.vs);
+                dispatch_pixel_format(this->samples.format, [&]<PixelFormat P>() {
+                    dispatch_depth_format(this->samples.depth_format, [&]<DepthFormat D>() {
+                        this->render_triangle<P, D>(triangle, shader, state, area);
+                    });
+                });
+                shader.clear_vertex_states();
+            }
+        }
+
+        // Averages the samples of each pixel into 'target', which needs to
+        // match the size of this surface. Only the pixels that have changed
+        // since the last resolve (drawn to, or cleared after being drawn to)
+        // are written, so the target needs to be the same surface every
+        // time, unless 'all' is true.
+        void resolve(Surface& target, bool all = false);
+
+        private:
+        // in pixels, the area drawn to since the last clear and the area
+        // changed since the last resolve
+        Rect drawn;
+        Rect unresolved;
+
+        void verify_draw_state(const DrawState& state) const;
+
+        template<PixelFormat P, DepthFormat D, typename V, typename S>
+        void render_triangle(
+            ShadedTriangle<V, S>& triangle, S& shader, const DrawState& state,
+            const Rect& area
+        ) {
+            using Pixel = PixelTraits<P>;
+            using Depth = DepthTraits<D>;
+            int count = this->sample_count;
+            const Vec<2>* offsets = multisample_positions(count);
+            VertexStates<V, S>& vs = triangle.vs;
+            Vec<2> a = triangle.a.template swizzle<2>("xy");
+            Vec<2> b = triangle.b.template swizzle<2>("xy");
+            Vec<2> c = triangle.c.template swizzle<2>("xy");
+            double area_signed = signed_triangle_area(a, b, c);
+            // the barycentric coordinates are affine in the pixel position
+            // ('base + dx * x + dy * y'), with the one of each vertex being
+            // the signed area of the opposite edge and the position
+            double base[3];
+            double dx[3];
+            double dy[3];
+            // how much a coordinate changes at most between the pixel
+            // position and any of its samples
+            double reach[3];
+            // if a sample lies exactly on an edge, it only belongs to the
+            // triangle on one side of it, so shared edges aren't drawn twice
+            bool owns_edge[3];
+            Vec<2> edges[3][2] = { { b, c }, { c, a }, { a, b } };
+            for(int i = 0; i < 3; i += 1) {
+                const Vec<2>& p = edges[i][0];
+                const Vec<2>& q = edges[i][1];
+                base[i] = 0.5 * (p.x() * q.y() - q.x() * p.y()) / area_signed;
+                dx[i] = 0.5 * (p.y() - q.y()) / area_signed;
+                dy[i] = 0.5 * (q.x() - p.x()) / area_signed;
+                reach[i] = 0.5 * (std::fabs(dx[i]) + std::fabs(dy[i]));
+                owns_edge[i] = dx[i] > 0.0 || (dx[i] == 0.0 && dy[i] > 0.0);
+            }
+            double z[3] = { triangle.a.z(), triangle.b.z(), triangle.c.z() };
+            double idepth[3] = { vs.a_idepth, vs.b_idepth, vs.c_idepth };
+            auto encode = [&](const Vec<4>& color) {
+                if constexpr (P == PixelFormat::RGBA8) {
+                    if(this->samples.srgb) {
+                        float linear[4] = {
+                            (float) color.r(), (float) color.g(),
+                            (float) color.b(), (float) color.a()
+                        };
+                        Color encoded;
+                        conversion::pack_srgb8(linear, &encoded, 1);
+                        return encoded;
+                    }
+                }
+                return Pixel::encode(color);
+            };
+            auto decode = [&](typename Pixel::Stored stored) {
+                if constexpr (P == PixelFormat::RGBA8) {
+                    if(this->samples.srgb) {
+                        float linear[4];
+                        conversion::unpack_srgb8(&stored, linear, 1);
+                        return Vec<4>(linear[0], linear[1], linear[2], linear[3]);
+                    }
+                }
+                return Pixel::decode(stored);
+            };
+            for(int y = area.y; y < area.y + area.height; y += 1) {
+                typename Pixel::Stored* color_row
+                    = (typename Pixel::Stored*) this->samples.color
+                    + (size_t) y * this->samples.pitch;
+                typename Depth::Stored* depth_row
+                    = (typename Depth::Stored*) this->samples.depth
+                    + (size_t) y * this->samples.pitch;
+                for(int x = area.x; x < area.x + area.width; x += 1) {
+                    double bc[3];
+                    bool outside = false;
+                    for(int i = 0; i < 3; i += 1) {
+                        bc[i] = base[i] + dx[i] * x + dy[i] * y;
+                        outside |= bc[i] < -reach[i];
+                    }
+                    if(outside) { continue; }
+                    // determine coverage and depth of each sample
+                    uint32_t mask = 0;
+                    int first_sample = -1;
+                    for(int s = 0; s < count; s += 1) {
+                        double sbc[3];
+                        bool covered = true;
+                        for(int i = 0; i < 3; i += 1) {
+                            sbc[i] = bc[i] + dx[i] * offsets[s].x()
+                                + dy[i] * offsets[s].y();
+                            covered &= sbc[i] > 0.0
+                                || (sbc[i] == 0.0 && owns_edge[i]);
+                        }
+                        if(!covered) { continue; }
+                        double s_idepth = sbc[0] * idepth[0]
+                            + sbc[1] * idepth[1] + sbc[2] * idepth[2];
+                        if(s_idepth <= 0.0) { continue; }
+                        double s_depth = (sbc[0] * z[0] + sbc[1] * z[1]
+                            + sbc[2] * z[2]) * 0.5 + 0.5;
+                        if(s_depth < 0.0 || s_depth > 1.0) { continue; }
+                        typename Depth::Stored s_stored = Depth::encode(s_depth);
+                        typename Depth::Stored& stored = depth_row[x * count + s];
+                        if(!Depth::passes(s_stored, stored)) { continue; }
+                        if(state.depth_write) { stored = s_stored; }
+                        mask |= 1 << s;
+                        if(first_sample == -1) { first_sample = s; }
+                    }
+                    if(mask == 0) { continue; }
+                    // shade once, at the pixel position if it is inside the
+                    // triangle and at a covered sample otherwise, so that
+                    // attributes are never extrapolated
+                    if(bc[0] < 0.0 || bc[1] < 0.0 || bc[2] < 0.0) {
+                        const Vec<2>& offset = offsets[first_sample];
+                        for(int i = 0; i < 3; i += 1) {
+                            bc[i] += dx[i] * offset.x() + dy[i] * offset.y();
+                        }
+                    }
+                    vs.a_bc = bc[0];
+                    vs.b_bc = bc[1];
+                    vs.c_bc = bc[2];
+                    double px_idepth = bc[0] * idepth[0] + bc[1] * idepth[1]
+                        + bc[2] * idepth[2];
+                    if(px_idepth <= 0.0) { continue; }
+                    vs.depth = 1.0 / px_idepth;
+                    Vec<4> fragment = shader.fragment();
+                    typename Pixel::Stored* pixel = color_row + x * count;
+                    if(state.blend == blending::Mode::REPLACE) {
+                        typename Pixel::Stored encoded = encode(fragment);
+                        for(int s = 0; s < count; s += 1) {
+                            if(mask & (1 << s)) { pixel[s] = encoded; }
+                        }
+                        continue;
+                    }
+                    for(int s = 0; s < count; s += 1) {
+                        if(!(mask & (1 << s))) { continue; }
+                        pixel[s] = encode(
+                            blending::blend(state.blend, fragment, decode(pixel[s]))
+                        );
+                    }
+                }
+            }
+        }
+    };
+
+}
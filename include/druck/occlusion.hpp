@@ -0,0 +1,144 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include <vector>
+#include <tuple>
+#include <cstdint>
+#include <algorithm>
+
+namespace druck::rendering {
+
+    // An axis-aligned box
+    struct Box {
+        Vec<3> min;
+        Vec<3> max;
+    };
+
+    // The smallest box containing all vertices of the mesh, with
+    // 'position(vertex)' returning the position of a vertex
+    template<typename V, typename F>
+    Box bounding_box(const Mesh<V>& mesh, F&& position) {
+        if(mesh.vertices.empty()) { return Box(); }
+        Box box = { position(mesh.vertices[0]), position(mesh.vertices[0]) };
+        for(const V& vertex: mesh.vertices) {
+            Vec<3> p = position(vertex);
+            for(int i = 0; i < 3; i += 1) {
+                box.min[i] = std::min(box.min[i], p[i]);
+                box.max[i] = std::max(box.max[i], p[i]);
+            }
+        }
+        return box;
+    }
+
+    // Occlusion queries: the faces of 'box' facing the camera (with the box
+    // transformed by 'model_view_projection') are rasterized against the
+    // depth buffer of 'surface', without writing to it or to the colors.
+    // Boxes that reach behind the camera are always visible (and count as
+    // covering the whole surface), and so is everything on surfaces
+    // without a depth buffer.
+    // A query right after drawing the occluders (for example the large or
+    // close parts of the scene) decides in the same frame whether to draw
+    // the object inside the box. For the rest, see 'OcclusionQueries'.
+
+    // The number of pixels of the box that pass the depth test
+    size_t count_visible_pixels(
+        const Surface& surface, const Box& box,
+        const Mat<4>& model_view_projection
+    );
+    // Whether any pixel of the box passes the depth test (stops at the
+    // first one that does)
+    bool is_visible(
+        const Surface& surface, const Box& box,
+        const Mat<4>& model_view_projection
+    );
+
+    // Remembers the results of occlusion queries for a set of objects,
+    // for using them one frame later: objects are only drawn if they
+    // were visible in the previous frame, and after drawing the frame
+    // all objects are tested against its finished depth buffer. This
+    // needs no ordering of the draws, but objects coming into view
+    // show up one frame late.
+    struct OcclusionQueries {
+        // Tests the box of the given object (an index chosen by the
+        // caller) and remembers the result
+        void test(
+            size_t object, const Surface& surface, const Box& box,
+            const Mat<4>& model_view_projection
+        );
+        // The result of the last test of the object (objects that have
+        // not been tested yet are visible)
+        bool was_visible(size_t object) const;
+        // Forgets all results (for example after a camera cut)
+        void reset();
+
+        private:
+        std::vector<bool> visible;
+    };
+
+
+
+    // A low resolution depth buffer for culling objects hidden behind
+    // large occluders before drawing them: at the start of each frame,
+    // simplified meshes of the occluders (walls, terrain, large buildings
+    // and the like) are drawn into it, after which the bounding boxes of
+    // the other objects are tested against it.
+    // The buffer covers the same view as the surface that is drawn to,
+    // just at a lower resolution (ideally with the same aspect ratio).
+    // Occluders are sampled at the pixel centers of the buffer (so objects
+    // peeking out less than a pixel of the buffer behind the edge of an
+    // occluder may be culled), and boxes are tested with their closest
+    // depth over the whole rectangle they cover. Both process 4 pixels at
+    // once with SSE2 where available.
+    struct OcclusionBuffer {
+        int width;
+        int height;
+
+        OcclusionBuffer(int width = 256, int height = 128);
+
+        // Resets the depth of every pixel to the far plane
+        void clear();
+
+        // Draws the triangles of the mesh, transformed by
+        // 'model_view_projection', with 'position(vertex)' returning the
+        // position of a vertex. Triangles reaching in front of the near
+        // plane are skipped (they are not clipped).
+        template<typename V, typename F>
+        void draw_occluder(
+            const Mesh<V>& mesh, const Mat<4>& model_view_projection,
+            F&& position
+        ) {
+            this->clip_positions.resize(mesh.vertices.size());
+            for(size_t vert_i = 0; vert_i < mesh.vertices.size(); vert_i += 1) {
+                Vec<3> p = position(mesh.vertices[vert_i]);
+                this->clip_positions[vert_i] = model_view_projection * p.with(1.0);
+            }
+            this->draw_triangles(mesh.elements);
+        }
+
+        // Whether any part of the box may be visible (false if it is
+        // hidden behind the occluders or outside of the view). Boxes that
+        // reach behind the camera are always visible.
+        bool is_visible(
+            const Box& box, const Mat<4>& model_view_projection
+        ) const;
+
+        private:
+        // 'width' rounded up to a multiple of 4 (the distance between the
+        // starts of two rows in 'depth')
+        int pitch;
+        // window space depths in [0, 1]
+        std::vector<float> depth;
+        // the vertices of the occluder being drawn, in clip space
+        std::vector<Vec<4>> clip_positions;
+
+        void draw_triangles(
+            const std::vector<std::tuple<uint32_t, uint32_t, uint32_t>>& elements
+        );
+        void draw_triangle(const Vec<3>& a, const Vec<3>& b, const Vec<3>& c);
+        // The position of a point in clip space in the pixels of the
+        // buffer, and its window space depth
+        Vec<3> to_buffer_space(const Vec<4>& clip) const;
+    };
+
+}
@@ -0,0 +1,132 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include <vector>
+#include <cstdint>
+
+namespace druck::postprocess {
+
+    namespace rendering = druck::rendering;
+    using druck::math::Vec;
+
+
+    // Fast approximate anti-aliasing, a filter over a finished image that
+    // finds edges by the contrast in luma and blends pixels across them.
+    // Colors are filtered as they are stored (so sRGB-encoded surfaces are
+    // filtered in a perceptual space, as intended).
+    struct Fxaa {
+        // Pixels are only filtered if the contrast to their neighbors is at
+        // least 'edge_threshold' times their highest luma, and at least
+        // 'edge_threshold_min'. 'subpixel' is the strength of the blending
+        // for single pixel features (0 to 1).
+        Fxaa(
+            double edge_threshold = 0.125,
+            double edge_threshold_min = 0.0625,
+            double subpixel = 0.75
+        );
+
+        // Filters 'src' into 'dest', which both need to be RGBA8 surfaces
+        // of the same size
+        void apply(const rendering::Surface& src, rendering::Surface& dest);
+
+        private:
+        uint16_t edge_threshold; // in 1/65536
+        uint8_t edge_threshold_min;
+        float subpixel;
+
+        // the contrast of the pixel with the given luma (and that of its
+        // neighbors) if it is on an edge, 0 otherwise
+        int edge_contrast(int m, int n, int s, int w, int e) const;
+        // filters (and copies) the given rows of 'src' into 'dest', with a
+        // single pass over each row
+        void filter_rows(
+            const rendering::Surface& src, rendering::Surface& dest,
+            int start_y, int end_y
+        ) const;
+        // 'above', 'center' and 'below' are the padded luma of the rows
+        // around the pixel
+        rendering::Color filter_pixel(
+            const rendering::Surface& src, int x, int y, int contrast,
+            const uint8_t* above, const uint8_t* center, const uint8_t* below
+        ) const;
+    };
+
+
+
+    enum Tonemap {
+        REINHARD, // c / (1 + c)
+        ACES // the curve fit by Narkowicz (2015), with more contrast
+    };
+
+    // Adjustments to (usually tone mapped) colors, in the order listed
+    struct Grading {
+        Vec<3> tint = Vec<3>(1.0, 1.0, 1.0); // multiplied with the color
+        double saturation = 1.0; // 0 is grayscale
+        double contrast = 1.0; // scales the distance to 0.5
+        Vec<3> lift = Vec<3>(0.0, 0.0, 0.0); // added to the color
+    };
+
+    // A sequence of full screen effects, applied from one surface to
+    // another in the order they have been added. Effects work on linear
+    // float colors (sRGB surfaces are decoded and encoded on the way),
+    // so the source can be an HDR image.
+    // Consecutive per-pixel effects are fused into the pass before them
+    // (the one reading the source, or the last pass of a blur), the first
+    // blur reads the source directly and the last pass writes to the
+    // destination directly. A chain without blurs makes a single pass over
+    // the image, and each blur adds one more.
+    struct Chain {
+        // Gaussian blur with the given standard deviation (in pixels)
+        void add_blur(double sigma);
+        // Adds the parts of the image brighter than 'threshold', blurred
+        // with the given standard deviation and scaled by 'intensity'
+        void add_bloom(double threshold, double intensity, double sigma);
+        // Maps HDR colors (multiplied by 'exposure' first) to [0, 1]
+        void add_tonemap(
+            Tonemap tonemap = Tonemap::ACES, double exposure = 1.0
+        );
+        void add_grading(const Grading& grading);
+        // Removes all effects
+        void clear();
+
+        // 'src' and 'dest' need to be of the same size, but may be the same
+        // surface or use different formats
+        void apply(const rendering::Surface& src, rendering::Surface& dest);
+
+        private:
+        struct PixelOp {
+            enum Kind { MATRIX, REINHARD, ACES } kind;
+            // for 'MATRIX': the columns multiplied with r, g, b and a,
+            // followed by the offset (RGBA each)
+            float matrix[20];
+        };
+
+        // a separable convolution (followed by per-pixel effects)
+        struct Stage {
+            bool bloom;
+            float threshold;
+            float intensity;
+            // the weights from the center to the edge of the kernel
+            std::vector<float> kernel;
+            std::vector<PixelOp> ops;
+        };
+
+        // applied to the source while it is read
+        std::vector<PixelOp> source_ops;
+        std::vector<Stage> stages;
+        // RGBA float quadruples of the image and of the horizontally
+        // convolved image
+        std::vector<float> current;
+        std::vector<float> convolved;
+
+        void add_op(const PixelOp& op);
+        void add_matrix(const float* matrix);
+        // reads 'current', or 'src' (with 'source_ops' applied) if given
+        void convolve(
+            const Stage& stage, const rendering::Surface* src,
+            rendering::Surface& dest, bool last
+        );
+    };
+
+}
@@ -1,11 +1,14 @@
 
 #pragma once
 
-#include <raylib.h>
 #include <vector>
+#include <algorithm>
 #include <tuple>
 #include <cstdint>
 #include "math.hpp"
+#include "formats.hpp"
+#include "conversion.hpp"
+#include "blending.hpp"
 
 #include <cassert>
 
@@ -23,21 +26,39 @@ namespace druck::rendering {
         );
     }
 
-    struct Color {
-        uint8_t r;
-        uint8_t g;
-        uint8_t b;
-        uint8_t a;
-
-        static Color from_floats(const Vec<4>& color) {
-            return {
-                static_cast<uint8_t>(color.r() * 255.0),
-                static_cast<uint8_t>(color.g() * 255.0),
-                static_cast<uint8_t>(color.b() * 255.0),
-                static_cast<uint8_t>(color.a() * 255.0)
-            };
-        }
-    };
+    // Same as above, but positive if 'a', 'b' and 'c' are in clockwise order
+    // (in pixel space, where y points down) and negative otherwise
+    inline double signed_triangle_area(Vec<2> a, Vec<2> b, Vec<2> c) {
+        return 0.5 * (
+            a.x() * (b.y() - c.y())
+                + b.x() * (c.y() - a.y())
+                + c.x() * (a.y() - b.y())
+        );
+    }
+
+    // The transformation from normalized device coordinates to the pixel
+    // space of a surface with the given size. NDC z takes the place of the
+    // homogeneous coordinate, so the result depends on it as well.
+    static Mat<3> ndc_to_pixel_space(int width, int height) {
+        return Mat<3>::translate(Vec<2>(0, height))
+            * Mat<3>::scale(Vec<2>(width / 2, height / 2 * -1))
+            * Mat<3>::translate(Vec<2>(1, 1));
+    }
+
+    // The inverse of the above, for a pixel position with the given
+    // window space depth (in [0, 1], as stored in depth buffers)
+    inline Vec<3> pixel_to_ndc(
+        double x, double y, double depth, int width, int height
+    ) {
+        double z = depth * 2.0 - 1.0;
+        double half_width = width / 2;
+        double half_height = height / 2;
+        return Vec<3>(
+            x / half_width - z,
+            (height * z - y) / half_height - z,
+            z
+        );
+    }
 
     template<typename V>
     struct Mesh {
@@ -143,14 +164,362 @@ namespace druck::rendering {
         }
     };
 
+    // How many pixels share the result of one 'fragment' call, as the
+    // width and height of a block of pixels
+    enum ShadingRate {
+        SHADE_1X1 = 1,
+        SHADE_2X2 = 2,
+        SHADE_4X4 = 4
+    };
+
+    // Shading rates for square tiles of a surface (for example coarser
+    // ones for the periphery or for low detail regions)
+    struct ShadingRateImage {
+        int tile_size;
+        // in tiles
+        int width;
+        int height;
+        std::vector<ShadingRate> rates;
+
+        // 'tile_size' needs to be a multiple of 4, so that blocks of pixels
+        // never cross tiles
+        ShadingRateImage(
+            int surface_width, int surface_height, int tile_size = 16,
+            ShadingRate rate = ShadingRate::SHADE_1X1
+        );
+
+        void set_rate(int tile_x, int tile_y, ShadingRate rate);
+        ShadingRate get_rate(int tile_x, int tile_y) const;
+        // Whether the tiles cover a surface of the given size
+        bool covers(int surface_width, int surface_height) const;
+        // The rate of the tile containing the given pixel (which needs to
+        // be inside the covered area)
+        ShadingRate rate_at(int x, int y) const {
+            return this->rates[
+                (y / this->tile_size) * this->width + x / this->tile_size
+            ];
+        }
+    };
+
+    // Which pixels get shaded in a frame (see 'Interlacer')
+    enum PixelPattern {
+        ALL_PIXELS,
+        CHECKERBOARD, // pixels with an even 'x + y + phase'
+        ALTERNATE_ROWS // rows with an even 'y + phase'
+    };
+
+    static bool is_shaded(PixelPattern pattern, int phase, int x, int y) {
+        switch(pattern) {
+            case PixelPattern::ALL_PIXELS: return true;
+            case PixelPattern::CHECKERBOARD: return ((x + y + phase) & 1) == 0;
+            case PixelPattern::ALTERNATE_ROWS: return ((y + phase) & 1) == 0;
+        }
+        return true;
+    }
+
+    // State that applies to a whole draw call
+    struct DrawState {
+        blending::Mode blend = blending::Mode::REPLACE;
+        // if false, fragments are still depth tested but don't write their
+        // depth (usually wanted for blended, transparent geometry)
+        bool depth_write = true;
+        // depth is still tested for every pixel, only shading is coarse
+        ShadingRate shading_rate = ShadingRate::SHADE_1X1;
+        // if given, pixels use the coarser rate out of 'shading_rate' and the
+        // one of their tile (the image needs to cover the surface)
+        const ShadingRateImage* shading_rate_image = nullptr;
+        // pixels left out by the pattern are still depth tested and written,
+        // but not shaded
+        PixelPattern pattern = PixelPattern::ALL_PIXELS;
+        int pattern_phase = 0;
+    };
+
+    // A rectangle of pixels, which is empty if it has no width or height
+    struct Rect {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+
+        bool is_empty() const;
+        // The smallest rectangle containing both
+        Rect united(const Rect& other) const;
+        Rect intersected(const Rect& other) const;
+    };
+
+    // A triangle after running the vertex shader on its vertices, in pixel
+    // space with 'a', 'b' and 'c' sorted by ascending y
+    template<typename V, typename S>
+    struct ShadedTriangle {
+        Vec<3> a;
+        Vec<3> b;
+        Vec<3> c;
+        double area;
+        VertexStates<V, S> vs;
+    };
+
+    // Converts a triangle to the pixel space of a surface with the given
+    // size, after the vertex shader has been run for its vertices (with
+    // the shaders in 'triangle.vs' and the given clip space positions).
+    // Returns false if the triangle can't be visible.
+    template<typename V, typename S>
+    bool setup_triangle(
+        Vec<4> a_clip, Vec<4> b_clip, Vec<4> c_clip, int width, int height,
+        ShadedTriangle<V, S>& triangle
+    ) {
+        VertexStates<V, S>& vs = triangle.vs;
+        if(a_clip.w() <= 0 || a_clip.z() == 0) { return false; }
+        vs.a_idepth = 1.0 / a_clip.z();
+        if(b_clip.w() <= 0 || b_clip.z() == 0) { return false; }
+        vs.b_idepth = 1.0 / b_clip.z();
+        if(c_clip.w() <= 0 || c_clip.z() == 0) { return false; }
+        vs.c_idepth = 1.0 / c_clip.z();
+        // perform perspective division
+        Vec<3> a_ndc = a_clip.swizzle<3>("xyz") / a_clip.w();
+        Vec<3> b_ndc = b_clip.swizzle<3>("xyz") / b_clip.w();
+        Vec<3> c_ndc = c_clip.swizzle<3>("xyz") / c_clip.w();
+        // convert vertices to pixel space
+        Mat<3> to_pixel_space = ndc_to_pixel_space(width, height);
+        Vec<3>& a = triangle.a;
+        Vec<3>& b = triangle.b;
+        Vec<3>& c = triangle.c;
+        a = to_pixel_space * a_ndc;
+        b = to_pixel_space * b_ndc;
+        c = to_pixel_space * c_ndc;
+        // sort vertex pixel positions (a, b, c in order of ascending y)
+        if(a.y() > b.y()) {
+            std::swap(a, b);
+            std::swap(vs.a_state, vs.b_state);
+            std::swap(vs.a_idepth, vs.b_idepth);
+        } 
+        if(b.y() > c.y()) { 
+            std::swap(b, c);
+            std::swap(vs.b_state, vs.c_state);
+            std::swap(vs.b_idepth, vs.c_idepth);
+        } 
+        if(a.y() > b.y()) { 
+            std::swap(a, b); 
+            std::swap(vs.a_state, vs.b_state);
+            std::swap(vs.a_idepth, vs.b_idepth);
+        }
+        // compute size of triangle
+        triangle.area = triangle_area(
+            a.swizzle<2>("xy"), b.swizzle<2>("xy"), c.swizzle<2>("xy")
+        );
+        return triangle.area != 0.0;
+    }
+
+    // Runs the vertex shader for all vertices and converts them to the pixel
+    // space of a surface with the given size.
+    // Returns false if the triangle can't be visible.
+    template<typename V, typename S>
+    bool shade_triangle(
+        V vertex_a, V vertex_b, V vertex_c, S& shader, int width, int height,
+        ShadedTriangle<V, S>& triangle
+    ) {
+        VertexStates<V, S>& vs = triangle.vs;
+        vs.a_state = shader;
+        Vec<4> a_clip = vs.a_state.vertex(vertex_a);
+        vs.b_state = shader;
+        Vec<4> b_clip = vs.b_state.vertex(vertex_b);
+        vs.c_state = shader;
+        Vec<4> c_clip = vs.c_state.vertex(vertex_c);
+        return setup_triangle(a_clip, b_clip, c_clip, width, height, triangle);
+    }
+
+    // The maximum number of vertices a 'VertexCache' remembers
+    #define VERTEX_CACHE_SIZE 32
+
+    // Remembers the results of the vertex shader for recently shaded
+    // vertices of a mesh, so that vertices shared by triangles close to
+    // each other in 'mesh.elements' are only shaded once. The cache is
+    // direct mapped (vertex i can only be stored in entry i modulo the
+    // size), see 'optimize_vertex_cache' for ordering meshes to make the
+    // most of it. It is only valid while the shader does not change.
+    template<typename V, typename S>
+    struct VertexCache {
+        VertexCache(const Mesh<V>& mesh, const S& shader)
+            : mesh(mesh), shader(shader) {
+            size_t size = std::min(
+                (size_t) VERTEX_CACHE_SIZE, mesh.vertices.size()
+            );
+            this->entries.resize(size, Entry { UINT32_MAX, shader, Vec<4>() });
+        }
+
+        // Like 'shade_triangle', for the triangle at the given index of
+        // 'mesh.elements'
+        bool shade_triangle(
+            size_t element, int width, int height,
+            ShadedTriangle<V, S>& triangle
+        ) {
+            auto [a, b, c] = this->mesh.elements[element];
+            VertexStates<V, S>& vs = triangle.vs;
+            Vec<4> a_clip = this->shade_vertex(a, vs.a_state);
+            Vec<4> b_clip = this->shade_vertex(b, vs.b_state);
+            Vec<4> c_clip = this->shade_vertex(c, vs.c_state);
+            return setup_triangle(a_clip, b_clip, c_clip, width, height, triangle);
+        }
+
+        private:
+        struct Entry {
+            uint32_t vertex; // 'UINT32_MAX' if unused
+            S state; // shader after running 'vertex' for the vertex
+            Vec<4> clip;
+        };
+
+        const Mesh<V>& mesh;
+        const S& shader;
+        std::vector<Entry> entries;
+
+        Vec<4> shade_vertex(uint32_t vertex, S& state) {
+            Entry& entry = this->entries[vertex % this->entries.size()];
+            if(entry.vertex != vertex) {
+                entry.vertex = vertex;
+                entry.state = this->shader;
+                entry.clip = entry.state.vertex(this->mesh.vertices[vertex]);
+            }
+            state = entry.state;
+            return entry.clip;
+        }
+    };
+
+    // The pixels a triangle may cover (clamped first, since vertices may be
+    // arbitrarily far outside of the surface)
+    template<typename V, typename S>
+    Rect triangle_bounds(
+        const ShadedTriangle<V, S>& triangle, int width, int height
+    ) {
+        const Vec<3>& a = triangle.a;
+        const Vec<3>& b = triangle.b;
+        const Vec<3>& c = triangle.c;
+        auto bound = [](double v, int size) {
+            return (int) std::clamp(v, -1.0, size + 1.0);
+        };
+        int min_x = bound(std::floor(std::min({ a.x(), b.x(), c.x() })), width);
+        int max_x = bound(std::ceil(std::max({ a.x(), b.x(), c.x() })), width);
+        int min_y = bound(std::floor(a.y()), height);
+        int max_y = bound(std::ceil(c.y()), height);
+        return Rect { min_x, min_y, max_x - min_x + 1, max_y - min_y + 1 }
+            .intersected({ 0, 0, width, height });
+    }
+
+    // Visits the pixels of one half of the triangle (see 'rasterize_triangle')
+    template<typename V, typename S, typename F, typename R>
+    void rasterize_segment(
+        ShadedTriangle<V, S>& triangle, const Rect& clip,
+        Vec<2> s_high, // top vertex of the segment
+        Vec<2> s_low, // bottom vertex of the segment
+        F& fragment, R& row_done
+    ) {
+        Vec<3>& a = triangle.a;
+        Vec<3>& b = triangle.b;
+        Vec<3>& c = triangle.c;
+        VertexStates<V, S>* vs = &triangle.vs;
+        double t_area = triangle.area;
+        Vec<2> t_high = a.swizzle<2>("xy"); // top vertex of the triangle
+        Vec<2> t_low = c.swizzle<2>("xy"); // bottom vertex of the triangle
+        Vec<2> s_line = s_low - s_high; // vector from top to bottom of segment
+        Vec<2> t_line = t_low - t_high; // vector from top to bottom of triangle
+        int end_x = clip.x + clip.width;
+        int end_y = clip.y + clip.height;
+        for(int y = std::max((int) s_high.y() + 1, clip.y); y < s_low.y(); y += 1) {
+            if(y >= end_y) { break; }
+            double s_progress = (y - s_high.y()) / s_line.y();
+            Vec<2> r_point = s_line * s_progress + s_high;
+            double t_progress = (y - t_high.y()) / t_line.y();
+            Vec<2> l_point = t_line * t_progress + t_high;
+            if(l_point.x() > r_point.x()) { std::swap(l_point, r_point); }
+            for(int x = std::max((int) l_point.x() + 1, clip.x); x <= r_point.x(); x += 1) {
+                if(x >= end_x) { break; }
+                Vec<2> p = Vec<2>(x, y);
+                vs->a_bc = triangle_area(p, b.swizzle<2>("xy"), c.swizzle<2>("xy")) / t_area;
+                vs->b_bc = triangle_area(p, c.swizzle<2>("xy"), a.swizzle<2>("xy")) / t_area;
+                vs->c_bc = triangle_area(p, a.swizzle<2>("xy"), b.swizzle<2>("xy")) / t_area;
+                double px_idepth = vs->a_bc * vs->a_idepth
+                    + vs->b_bc * vs->b_idepth
+                    + vs->c_bc * vs->c_idepth;
+                if(px_idepth == 0.0) { continue; }
+                vs->depth = 1.0 / px_idepth;
+                if(vs->depth <= 0.0) { continue; }
+                // NDC depth is linear in screen space, map it to [0, 1]
+                double px_depth = (vs->a_bc * a.z()
+                    + vs->b_bc * b.z()
+                    + vs->c_bc * c.z()) * 0.5 + 0.5;
+                if(px_depth < 0.0 || px_depth > 1.0) { continue; }
+                fragment(x, y, px_depth);
+            }
+            row_done(y);
+        }
+    }
+
+    // Visits every pixel of the triangle inside 'clip', row by row.
+    // For each pixel the interpolation state in 'triangle.vs' is updated
+    // before 'fragment(x, y, depth)' is called with the depth in [0, 1].
+    // 'row_done(y)' is called after each row.
+    template<typename V, typename S, typename F, typename R>
+    void rasterize_triangle(
+        ShadedTriangle<V, S>& triangle, const Rect& clip,
+        F&& fragment, R&& row_done
+    ) {
+        Vec<2> a = triangle.a.template swizzle<2>("xy");
+        Vec<2> b = triangle.b.template swizzle<2>("xy");
+        Vec<2> c = triangle.c.template swizzle<2>("xy");
+        // segment: high -> mid (top half)
+        rasterize_segment(triangle, clip, a, b, fragment, row_done);
+        // segment: mid -> low (bottom half)
+        rasterize_segment(triangle, clip, b, c, fragment, row_done);
+    }
+
+    // The maximum number of fragments the rasterizer shades before 
+    // converting and storing them in one batch
+    #define SURFACE_SPAN_SIZE 64
+
+    // The number of blocks of pixels the rasterizer remembers the shaded
+    // color of at coarse shading rates (blocks are looked up by their
+    // x-position, so only very wide triangles shade a block more than once)
+    #define SURFACE_BLOCK_CACHE_SIZE 128
+
+    // The alignment of the 'color' and 'depth' buffers of surfaces (in bytes)
+    #define SURFACE_ALIGNMENT 64
+
     struct Surface {
         int width;
         int height;
-        Color* color;
-        float* depth;
+        // the distance between the starts of two rows in 'color' and 'depth'
+        // (in pixels), padded so that every row starts 'SURFACE_ALIGNMENT'
+        // aligned
+        int pitch;
+        PixelFormat format;
+        void* color;
+        DepthFormat depth_format;
+        void* depth;
+        // if true, RGBA8 colors are stored sRGB-encoded, meaning that
+        // 'sample' decodes them to linear and fragment outputs get encoded
+        bool srgb = false;
+        // the union of all areas written to since the last call to
+        // 'clear_dirty' (which 'window::display_buffer' does after
+        // presenting the surface)
+        Rect dirty;
+        // the number of pixels (including padding) 'color' and 'depth' have
+        // room for, so that resizing to a size that fits does not reallocate
+        // them
+        size_t capacity = 0;
+        // unique to the current contents of the surface, changed when it
+        // is created, moved into or resized (even if 'color' stays the
+        // same), so that something keeping a copy of the pixels can tell
+        // whether 'dirty' still describes what changed since it was taken
+        uint64_t generation = 0;
 
-        Surface(int width, int height);
-        Surface(const Color* color, const float* depth, int width, int height);
+        Surface(
+            int width, int height,
+            PixelFormat format = PixelFormat::RGBA8,
+            DepthFormat depth_format = DepthFormat::FLOAT32
+        );
+        Surface(
+            const void* color, const void* depth, int width, int height,
+            PixelFormat format = PixelFormat::RGBA8,
+            DepthFormat depth_format = DepthFormat::FLOAT32
+        );
         Surface(const Surface&) = delete;
         Surface(Surface&&);
         Surface& operator=(const Surface& other) = delete;
@@ -164,135 +533,238 @@ namespace druck::rendering {
         double get_depth_at(int x, int y) const;
         void set_depth_at(int x, int y, double d);
         Vec<4> sample(const Vec<2>& uv) const;
+        void read_colors(Color* dest) const;
+        // Only reads the given area, with its rows stored one after another
+        void read_colors(Color* dest, const Rect& area) const;
+
+        // The pitch a surface with the given width and formats has
+        static int padded_pitch(
+            int width, PixelFormat format, DepthFormat depth_format
+        );
+
+        void mark_dirty(const Rect& area);
+        void clear_dirty();
 
         void resize(int width, int height);
         void resize(const Vec<2>& size);
         void clear();
 
+        // Copies 'src' into the given rectangle of this surface, scaling it
+        // to fit
         void blit_buffer(
             const Surface& src, 
             int dest_pos_x, int dest_pos_y,
             int dest_width, int dest_height
         );
+        // Same as 'blit_buffer', but only copies the part that 'src.dirty'
+        // maps to. Only useful if the rectangle already holds the rest of
+        // 'src', meaning that it has been blitted there before and 'dirty'
+        // has been cleared right after (which the caller has to make sure
+        // of, since 'window::display_buffer' clears it as well).
+        void blit_buffer_dirty(
+            const Surface& src,
+            int dest_pos_x, int dest_pos_y,
+            int dest_width, int dest_height
+        );
 
         private: 
-        template<typename V, typename S>
-        void render_triangle_segment(
-            Vec<3> a, Vec<3> b, Vec<3> c, double t_area,
-            Vec<2> s_high, // top vertex of the segment
-            Vec<2> s_low, // bottom vertex of the segment
-            VertexStates<V, S>* vs,
-            S& shader
+        // Fails if the state can't be used to draw to this surface
+        void verify_draw_state(const DrawState& state) const;
+
+        // Stores the shaded fragments at the given x-positions of the given row,
+        // blending them with the stored colors if needed
+        template<PixelFormat P>
+        void store_span(
+            typename PixelTraits<P>::Stored* row, 
+            const float* colors, const int* xs, size_t length,
+            blending::Mode blend
         ) {
-            Vec<2> t_high = a.swizzle<2>("xy"); // top vertex of the triangle
-            Vec<2> t_low = c.swizzle<2>("xy"); // bottom vertex of the triangle
-            Vec<2> s_line = s_low - s_high; // vector from top to bottom of segment
-            Vec<2> t_line = t_low - t_high; // vector from top to bottom of triangle
-            for(int y = std::max((int) s_high.y() + 1, 0); y < s_low.y(); y += 1) {
-                if(y > this->height) { break; }
-                double s_progress = (y - s_high.y()) / s_line.y();
-                Vec<2> r_point = s_line * s_progress + s_high;
-                double t_progress = (y - t_high.y()) / t_line.y();
-                Vec<2> l_point = t_line * t_progress + t_high;
-                if(l_point.x() > r_point.x()) { std::swap(l_point, r_point); }
-                for(int x = std::max((int) l_point.x() + 1, 0); x <= r_point.x(); x += 1) {
-                    if(x > this->width) { break; }
-                    Vec<2> p = Vec<2>(x, y);
-                    vs->a_bc = triangle_area(p, b.swizzle<2>("xy"), c.swizzle<2>("xy")) / t_area;
-                    vs->b_bc = triangle_area(p, c.swizzle<2>("xy"), a.swizzle<2>("xy")) / t_area;
-                    vs->c_bc = triangle_area(p, a.swizzle<2>("xy"), b.swizzle<2>("xy")) / t_area;
-                    double px_idepth = vs->a_bc * vs->a_idepth
-                        + vs->b_bc * vs->b_idepth
-                        + vs->c_bc * vs->c_idepth;
-                    if(px_idepth == 0.0) { continue; }
-                    vs->depth = 1.0 / px_idepth;
-                    if(vs->depth <= 0.0) { continue; }
-                    if(vs->depth >= this->get_depth_at(x, y)) { continue; }
-                    Color color = Color::from_floats(shader.fragment());
-                    this->set_color_at(x, y, color);
-                    this->set_depth_at(x, y, vs->depth);
+            bool replace = blend == blending::Mode::REPLACE;
+            if constexpr (P == PixelFormat::RGBA8) {
+                if(!this->srgb || replace) {
+                    Color packed[SURFACE_SPAN_SIZE];
+                    if(this->srgb) {
+                        conversion::pack_srgb8(colors, packed, length);
+                    } else {
+                        conversion::pack_rgba8(colors, packed, length);
+                    }
+                    if(!replace) {
+                        Color stored[SURFACE_SPAN_SIZE];
+                        for(size_t i = 0; i < length; i += 1) {
+                            stored[i] = row[xs[i]];
+                        }
+                        blending::blend_rgba8(blend, packed, stored, length);
+                        std::copy(stored, stored + length, packed);
+                    }
+                    for(size_t i = 0; i < length; i += 1) {
+                        row[xs[i]] = packed[i];
+                    }
+                    return;
+                }
+            }
+            if(replace) {
+                for(size_t i = 0; i < length; i += 1) {
+                    const float* c = colors + i * 4;
+                    row[xs[i]] = PixelTraits<P>::encode(
+                        Vec<4>(c[0], c[1], c[2], c[3])
+                    );
+                }
+                return;
+            }
+            // blend as floats (for sRGB surfaces in linear space)
+            float stored[SURFACE_SPAN_SIZE * 4];
+            if constexpr (P == PixelFormat::RGBA8) {
+                Color gathered[SURFACE_SPAN_SIZE];
+                for(size_t i = 0; i < length; i += 1) {
+                    gathered[i] = row[xs[i]];
+                }
+                conversion::unpack_srgb8(gathered, stored, length);
+                blending::blend_floats(blend, colors, stored, length);
+                conversion::pack_srgb8(stored, gathered, length);
+                for(size_t i = 0; i < length; i += 1) {
+                    row[xs[i]] = gathered[i];
+                }
+            } else {
+                for(size_t i = 0; i < length; i += 1) {
+                    Vec<4> c = PixelTraits<P>::decode(row[xs[i]]);
+                    float* d = stored + i * 4;
+                    d[0] = c.r(); d[1] = c.g(); d[2] = c.b(); d[3] = c.a();
+                }
+                blending::blend_floats(blend, colors, stored, length);
+                for(size_t i = 0; i < length; i += 1) {
+                    const float* d = stored + i * 4;
+                    row[xs[i]] = PixelTraits<P>::encode(
+                        Vec<4>(d[0], d[1], d[2], d[3])
+                    );
                 }
             }
         }
 
-        template<typename V, typename S>
-        void draw_triangle(V vertex_a, V vertex_b, V vertex_c, S& shader) {
-            VertexStates<V, S> vs;
-            // get positions from vertex shader
-            vs.a_state = shader;
-            Vec<4> a_clip = vs.a_state.vertex(vertex_a);
-            if(a_clip.w() <= 0 || a_clip.z() == 0) { return; }
-            vs.a_idepth = 1.0 / a_clip.z();
-            vs.b_state = shader;
-            Vec<4> b_clip = vs.b_state.vertex(vertex_b);
-            if(b_clip.w() <= 0 || b_clip.z() == 0) { return; }
-            vs.b_idepth = 1.0 / b_clip.z();
-            vs.c_state = shader;
-            Vec<4> c_clip = vs.c_state.vertex(vertex_c);
-            if(c_clip.w() <= 0 || c_clip.z() == 0) { return; }
-            vs.c_idepth = 1.0 / c_clip.z();
-            // perform perspective division
-            Vec<3> a_ndc = a_clip.swizzle<3>("xyz") / a_clip.w();
-            Vec<3> b_ndc = b_clip.swizzle<3>("xyz") / b_clip.w();
-            Vec<3> c_ndc = c_clip.swizzle<3>("xyz") / c_clip.w();
-            // convert vertices to pixel space
-            Mat<3> to_pixel_space
-                = Mat<3>::translate(Vec<2>(0, this->height))
-                * Mat<3>::scale(Vec<2>(this->width / 2, this->height / 2 * -1))
-                * Mat<3>::translate(Vec<2>(1, 1));
-            Vec<3> a = to_pixel_space * a_ndc;
-            Vec<3> b = to_pixel_space * b_ndc;
-            Vec<3> c = to_pixel_space * c_ndc;
-            // sort vertex pixel positions (a, b, c in order of ascending y)
-            if(a.y() > b.y()) {
-                std::swap(a, b);
-                std::swap(vs.a_state, vs.b_state);
-                std::swap(vs.a_idepth, vs.b_idepth);
-            } 
-            if(b.y() > c.y()) { 
-                std::swap(b, c);
-                std::swap(vs.b_state, vs.c_state);
-                std::swap(vs.b_idepth, vs.c_idepth);
-            } 
-            if(a.y() > b.y()) { 
-                std::swap(a, b); 
-                std::swap(vs.a_state, vs.b_state);
-                std::swap(vs.a_idepth, vs.b_idepth);
+        template<PixelFormat P, DepthFormat D, typename V, typename S>
+        void render_triangle(
+            ShadedTriangle<V, S>& triangle, S& shader, const DrawState& state
+        ) {
+            using Pixel = PixelTraits<P>;
+            using Depth = DepthTraits<D>;
+            float span_colors[SURFACE_SPAN_SIZE * 4];
+            int span_x[SURFACE_SPAN_SIZE];
+            size_t span_length = 0;
+            auto color_row = [&](int y) {
+                return (typename Pixel::Stored*) this->color + y * this->pitch;
+            };
+            // colors shaded for blocks of pixels at coarse shading rates
+            struct ShadedBlock {
+                int x;
+                int y;
+                int size; // 0 if unused
+                float color[4];
+            };
+            ShadedBlock blocks[SURFACE_BLOCK_CACHE_SIZE];
+            bool coarse = state.shading_rate != ShadingRate::SHADE_1X1
+                || state.shading_rate_image != nullptr;
+            if(coarse) {
+                for(ShadedBlock& block: blocks) { block.size = 0; }
             }
-            // compute size of triangle
-            double t_area = triangle_area(
-                a.swizzle<2>("xy"), b.swizzle<2>("xy"), c.swizzle<2>("xy")
-            );
-            if(t_area == 0.0) { return; }
-            // draw traingle segments
-            shader.set_vertex_states(&vs);
-            // segment: high -> mid (top half)
-            render_triangle_segment(
-                a, b, c, t_area,
-                a.swizzle<2>("xy"), b.swizzle<2>("xy"), &vs, shader
-            );
-            // segment: mid -> low (bottom half)
-            render_triangle_segment(
-                a, b, c, t_area,
-                b.swizzle<2>("xy"), c.swizzle<2>("xy"), &vs, shader
+            auto shade = [&](float* color) {
+                Vec<4> fragment = shader.fragment();
+                color[0] = fragment.r();
+                color[1] = fragment.g();
+                color[2] = fragment.b();
+                color[3] = fragment.a();
+            };
+            rasterize_triangle(
+                triangle, { 0, 0, this->width, this->height },
+                [&](int x, int y, double px_depth) {
+                    if(this->depth != nullptr) {
+                        typename Depth::Stored* px_depth_stored
+                            = (typename Depth::Stored*) this->depth
+                            + y * this->pitch + x;
+                        typename Depth::Stored px_stored = Depth::encode(px_depth);
+                        if(!Depth::passes(px_stored, *px_depth_stored)) { return; }
+                        if(state.depth_write) { *px_depth_stored = px_stored; }
+                    }
+                    if(!is_shaded(state.pattern, state.pattern_phase, x, y)) {
+                        return;
+                    }
+                    float* span_color = span_colors + span_length * 4;
+                    int size = state.shading_rate;
+                    if(state.shading_rate_image != nullptr) {
+                        size = std::max(
+                            size, (int) state.shading_rate_image->rate_at(x, y)
+                        );
+                    }
+                    if(size == 1) {
+                        shade(span_color);
+                    } else {
+                        // the first pixel of a block that passes the depth
+                        // test shades it for all others
+                        int block_x = x / size;
+                        int block_y = y / size;
+                        ShadedBlock& block
+                            = blocks[block_x % SURFACE_BLOCK_CACHE_SIZE];
+                        bool cached = block.x == block_x
+                            && block.y == block_y && block.size == size;
+                        if(!cached) {
+                            shade(block.color);
+                            block.x = block_x;
+                            block.y = block_y;
+                            block.size = size;
+                        }
+                        std::copy(block.color, block.color + 4, span_color);
+                    }
+                    span_x[span_length] = x;
+                    span_length += 1;
+                    if(span_length == SURFACE_SPAN_SIZE) {
+                        this->store_span<P>(
+                            color_row(y), span_colors, span_x, span_length,
+                            state.blend
+                        );
+                        span_length = 0;
+                    }
+                },
+                [&](int y) {
+                    this->store_span<P>(
+                        color_row(y), span_colors, span_x, span_length,
+                        state.blend
+                    );
+                    span_length = 0;
+                }
             );
+        }
+
+        template<typename V, typename S>
+        void draw_triangle(
+            ShadedTriangle<V, S>& triangle, S& shader, const DrawState& state
+        ) {
+            this->mark_dirty(triangle_bounds(triangle, this->width, this->height));
+            // draw traingle segments (specialized per pixel and depth format)
+            shader.set_vertex_states(&triangle.vs);
+            dispatch_pixel_format(this->format, [&]<PixelFormat P>() {
+                dispatch_depth_format(this->depth_format, [&]<DepthFormat D>() {
+                    this->render_triangle<P, D>(triangle, shader, state);
+                });
+            });
             shader.clear_vertex_states();
         }
 
         public:
         template<typename V, typename S>
-        void draw_mesh(const Mesh<V>& mesh, S& shader) {
+        void draw_mesh(
+            const Mesh<V>& mesh, S& shader,
+            const DrawState& state = DrawState()
+        ) {
             static_assert(std::is_base_of<Shader<V, S>, S>(), "Must be a shader!");
             static_assert(std::is_copy_constructible<S>(), "Must be copyable!");
-            for(uint16_t elem_i = 0; elem_i < mesh.elements.size(); elem_i += 1) {
-                auto indices = mesh.elements[elem_i];
-                this->draw_triangle(
-                    mesh.vertices[std::get<0>(indices)],
-                    mesh.vertices[std::get<1>(indices)],
-                    mesh.vertices[std::get<2>(indices)],
-                    shader
+            this->verify_draw_state(state);
+            VertexCache<V, S> cache(mesh, shader);
+            ShadedTriangle<V, S> triangle;
+            for(size_t elem_i = 0; elem_i < mesh.elements.size(); elem_i += 1) {
+                bool visible = cache.shade_triangle(
+                    elem_i, this->width, this->height, triangle
                 );
-            } 
+                if(!visible) { continue; }
+                this->draw_triangle(triangle, shader, state);
+            }
         }
 
     };
@@ -0,0 +1,55 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include "blit.hpp"
+#include <chrono>
+
+namespace druck::resolution {
+
+    namespace rendering = druck::rendering;
+
+
+    // Scales the resolution frames are rendered at, so that rendering takes
+    // about 'target_frame_time' seconds. Frames are rendered into a smaller
+    // surface when they take too long and upscaled to the output.
+    struct Controller {
+        Controller(
+            double target_frame_time,
+            double min_scale = 0.5, double max_scale = 1.0
+        );
+
+        // Measures the time between the two calls as the frame time.
+        // This only covers the rendering itself, which is usually what
+        // should be used (a frame time from 'window::delta_time' also
+        // includes waiting for the target FPS, so it never goes below it).
+        void begin_frame();
+        void end_frame();
+        // Uses the given frame time instead of an own measurement
+        void update(double frame_time);
+
+        // The current factor between render and output resolution (per axis)
+        double scale() const;
+        // Resizes 'target' to the output size multiplied by 'scale'.
+        // The surface keeps its buffers if they are large enough,
+        // so shrinking and growing back does not reallocate.
+        void apply(
+            rendering::Surface& target, int output_width, int output_height
+        ) const;
+        // Upscales 'target' to cover all of 'output'
+        void present(
+            const rendering::Surface& target, rendering::Surface& output,
+            blit::Filter filter = blit::Filter::BILINEAR
+        ) const;
+
+        private:
+        double target_frame_time;
+        double min_scale;
+        double max_scale;
+        double current_scale;
+        double average_frame_time;
+        int frames_since_change = 0;
+        std::chrono::steady_clock::time_point frame_start;
+    };
+
+}
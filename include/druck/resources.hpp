@@ -20,7 +20,11 @@ namespace druck::resources {
         Vec<2> uv;
         Vec<3> normal;
     };
-    rendering::Mesh<ModelVertex> read_obj_model(const char* file);
+    // If 'optimize' is true, the meshes are passed to
+    // 'rendering::optimize_mesh' (which logs the result)
+    rendering::Mesh<ModelVertex> read_obj_model(
+        const char* file, bool optimize = false
+    );
 
     rendering::Surface read_texture(const char* file);
 
@@ -60,6 +64,6 @@ namespace druck::resources {
             }
         }
     };
-    RiggedModel read_gltf_model(const char* file);
+    RiggedModel read_gltf_model(const char* file, bool optimize = false);
 
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+namespace druck::rendering {
+
+    // Hands out surfaces by size and format (for example for intermediate
+    // render targets), reusing released ones instead of allocating new ones.
+    // Surfaces that stay unused for 'max_idle_frames' frames are freed.
+    struct TargetPool {
+        TargetPool(uint64_t max_idle_frames = 60);
+        TargetPool(const TargetPool&) = delete;
+        TargetPool& operator=(const TargetPool& other) = delete;
+
+        // Returns a cleared surface of the given size and formats, which is
+        // one that has been released before if one with enough capacity
+        // and the same formats is available
+        Surface acquire(
+            int width, int height,
+            PixelFormat format = PixelFormat::RGBA8,
+            DepthFormat depth_format = DepthFormat::FLOAT32
+        );
+        // Hands a surface back to the pool to be reused
+        void release(Surface&& surface);
+        // Should be called once per frame, frees surfaces that have been
+        // unused for too long
+        void end_frame();
+        // Frees all surfaces currently in the pool
+        void clear();
+        size_t pooled_count();
+
+        private:
+        struct Entry {
+            Surface surface;
+            uint64_t released_frame;
+        };
+
+        uint64_t max_idle_frames;
+        uint64_t frame = 0;
+        std::vector<Entry> entries;
+        std::mutex lock;
+    };
+
+}
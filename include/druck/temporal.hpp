@@ -0,0 +1,115 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include <vector>
+#include <cstdint>
+
+namespace druck::rendering {
+
+    // Shades only half of the pixels each frame (alternating between the
+    // halves) and fills in the other half from the previous frame, by
+    // reprojecting it with the depth of the current frame and the previous
+    // view projection matrix. This assumes that only the camera moves.
+    // Where the reprojected point was hidden or outside of the previous
+    // frame, the missing pixel is interpolated from its shaded neighbors.
+    struct Interlacer {
+        // A reprojected pixel is rejected if the point it shows is further
+        // than 'tolerance' times its distance to the camera away from the
+        // point the previous frame shows there
+        Interlacer(
+            PixelPattern pattern = PixelPattern::CHECKERBOARD,
+            double tolerance = 0.02
+        );
+
+        // Starts a new frame, rendered with the given view projection
+        // matrix (switches to the other half of the pixels)
+        void begin_frame(const Mat<4>& view_projection);
+        // 'state' with the pattern of the current frame, to draw with
+        DrawState draw_state(DrawState state = DrawState()) const;
+        // Fills in the pixels of 'frame' that have not been shaded in the
+        // current frame, and remembers the result for the next one.
+        // 'frame' needs to have a depth buffer and all geometry of the
+        // frame needs to have been drawn with 'draw_state'.
+        void reconstruct(Surface& frame);
+        // Forgets the previous frame (for example after a camera cut)
+        void reset();
+
+        private:
+        PixelPattern pattern;
+        double tolerance;
+        int phase = 0;
+        Mat<4> view_projection;
+        Mat<4> previous_view_projection;
+        bool has_history = false;
+        Surface history = Surface(1, 1);
+    };
+
+
+
+    // Renders at a reduced resolution and accumulates the frames into a
+    // history at the output resolution. Each frame is offset by a
+    // different sub-pixel jitter, so that over several frames the history
+    // gets samples at more positions than a single frame has pixels.
+    // The history is reprojected using the depth of the current frame, and
+    // is rejected where it shows a different point (like in 'Interlacer')
+    // and clamped to the colors around each pixel in the current frame
+    // otherwise, which keeps moving edges from leaving trails.
+    struct TemporalUpscaler {
+        // 'feedback' is how much of the history is kept each frame
+        TemporalUpscaler(
+            int output_width, int output_height, double scale = 0.5,
+            double feedback = 0.9, double tolerance = 0.02
+        );
+
+        // The size frames need to be rendered at
+        int render_width() const;
+        int render_height() const;
+
+        // Starts a new frame, rendered with the given (unjittered) view
+        // projection matrix
+        void begin_frame(const Mat<4>& view_projection);
+        // The jitter of the current frame, as a matrix to multiply the
+        // projection with from the left (as in 'jitter() * projection * view')
+        Mat<4> jitter() const;
+        // Accumulates 'frame' (rendered with the jitter, at the render size
+        // and with a depth buffer) and writes the result to 'output'
+        // (which needs to be of the output size)
+        void resolve(const Surface& frame, Surface& output);
+        // Forgets the history (for example after a camera cut)
+        void reset();
+
+        private:
+        int output_width;
+        int output_height;
+        int width;
+        int height;
+        double feedback;
+        double tolerance;
+        uint32_t frame_index = 0;
+        // in render pixels
+        Vec<2> jitter_offset;
+        Vec<2> previous_jitter_offset;
+        Mat<4> view_projection;
+        Mat<4> previous_view_projection;
+        bool has_history = false;
+        // RGBA32F at the output size, without depth
+        Surface history;
+        Surface next_history;
+        // per rendered pixel: the decoded color and depth, the distance to
+        // the camera (also of the previous frame), the offset to where it
+        // was in the previous frame (only set where the history is valid)
+        // and the lowest and highest colors around it (in the current frame)
+        std::vector<float> current;
+        std::vector<float> depth;
+        std::vector<float> distance;
+        std::vector<float> previous_distance;
+        std::vector<float> motion;
+        std::vector<uint8_t> history_valid;
+        std::vector<float> bounds;
+        // per output column: the nearest rendered pixel and its weight
+        std::vector<int> column_pixels;
+        std::vector<float> column_weights;
+    };
+
+}
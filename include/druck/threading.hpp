@@ -0,0 +1,24 @@
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace druck::threading {
+
+    // Returns the number of threads work is distributed across
+    // (the worker threads and the calling thread)
+    size_t thread_count();
+
+    // Splits '[0, count)' into chunks of at least 'min_chunk' items
+    // and calls 'f(start, end)' for each of them on a shared pool of worker
+    // threads, with the calling thread participating.
+    // Returns once all chunks have been processed.
+    // Calls made while the pool is busy (from a worker or another thread)
+    // are run on the calling thread instead.
+    void parallel_for(
+        size_t count, size_t min_chunk,
+        const std::function<void(size_t, size_t)>& f
+    );
+
+}
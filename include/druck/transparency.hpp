@@ -0,0 +1,166 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include "threading.hpp"
+#include <vector>
+#include <string>
+
+namespace druck::rendering {
+
+    // The size of the square tiles transparent triangles are binned into
+    // and rasterized in parallel (in pixels)
+    #define TRANSPARENCY_TILE_SIZE 64
+
+    // The weight of a transparent fragment at the given depth (in [0, 1])
+    // with the given alpha, so that closer fragments contribute more
+    double transparency_weight(double depth, double alpha);
+
+    // Order-independent transparency using weighted blended accumulation.
+    // Transparent meshes may be drawn in any order: every fragment is added
+    // to 'accum' (premultiplied color and alpha, weighted by depth) and
+    // multiplies the 'revealage' (the product of '1 - alpha') in 'r'.
+    // 'resolve' then composites the weighted average over the opaque image.
+    // Triangles are binned into tiles that are rasterized in parallel,
+    // since each pixel is only ever written by the thread owning its tile.
+    struct TransparencyBuffer {
+        Surface accum;
+        Surface revealage;
+
+        TransparencyBuffer(int width, int height);
+
+        int width() const;
+        int height() const;
+
+        void resize(int width, int height);
+        // Resets the accumulated fragments, should be called once per frame
+        // (before drawing the transparent meshes)
+        void clear();
+
+        // Draws a transparent mesh, depth tested against (but not writing
+        // to) the depth of 'opaque', which needs to match the size of the
+        // buffer
+        template<typename V, typename S>
+        void draw_mesh(const Mesh<V>& mesh, S& shader, const Surface& opaque) {
+            static_assert(std::is_base_of<Shader<V, S>, S>(), "Must be a shader!");
+            static_assert(std::is_copy_constructible<S>(), "Must be copyable!");
+            this->verify_size(opaque, "opaque surface");
+            int width = this->width();
+            int height = this->height();
+            // run the vertex shader for all triangles first
+            std::vector<ShadedTriangle<V, S>> triangles;
+            std::vector<Rect> bounds;
+            triangles.reserve(mesh.elements.size());
+            bounds.reserve(mesh.elements.size());
+            VertexCache<V, S> cache(mesh, shader);
+            for(size_t elem_i = 0; elem_i < mesh.elements.size(); elem_i += 1) {
+                ShadedTriangle<V, S> triangle;
+                bool visible = cache.shade_triangle(
+                    elem_i, width, height, triangle
+                );
+                if(!visible) { continue; }
+                Rect area = triangle_bounds(triangle, width, height);
+                if(area.is_empty()) { continue; }
+                triangles.push_back(std::move(triangle));
+                bounds.push_back(area);
+                this->covered = this->covered.united(area);
+            }
+            if(triangles.size() == 0) { return; }
+            // bin the triangles into all tiles their bounds overlap
+            int tiles_x = (width + TRANSPARENCY_TILE_SIZE - 1)
+                / TRANSPARENCY_TILE_SIZE;
+            int tiles_y = (height + TRANSPARENCY_TILE_SIZE - 1)
+                / TRANSPARENCY_TILE_SIZE;
+            this->bins.resize((size_t) tiles_x * tiles_y);
+            for(std::vector<uint32_t>& bin: this->bins) { bin.clear(); }
+            for(size_t tri_i = 0; tri_i < triangles.size(); tri_i += 1) {
+                const Rect& area = bounds[tri_i];
+                int start_x = area.x / TRANSPARENCY_TILE_SIZE;
+                int end_x = (area.x + area.width - 1) / TRANSPARENCY_TILE_SIZE;
+                int start_y = area.y / TRANSPARENCY_TILE_SIZE;
+                int end_y = (area.y + area.height - 1) / TRANSPARENCY_TILE_SIZE;
+                for(int tile_y = start_y; tile_y <= end_y; tile_y += 1) {
+                    for(int tile_x = start_x; tile_x <= end_x; tile_x += 1) {
+                        this->bins[(size_t) tile_y * tiles_x + tile_x]
+                            .push_back((uint32_t) tri_i);
+                    }
+                }
+            }
+            // rasterize the tiles in parallel, each with its own copies of
+            // the shader and triangles (which are updated per fragment)
+            threading::parallel_for(this->bins.size(), 1, [&](
+                size_t start, size_t end
+            ) {
+                S tile_shader = shader;
+                for(size_t tile_i = start; tile_i < end; tile_i += 1) {
+                    const std::vector<uint32_t>& bin = this->bins[tile_i];
+                    if(bin.size() == 0) { continue; }
+                    Rect tile = Rect {
+                        (int) (tile_i % tiles_x) * TRANSPARENCY_TILE_SIZE,
+                        (int) (tile_i / tiles_x) * TRANSPARENCY_TILE_SIZE,
+                        TRANSPARENCY_TILE_SIZE, TRANSPARENCY_TILE_SIZE
+                    }.intersected({ 0, 0, width, height });
+                    for(uint32_t tri_i: bin) {
+                        ShadedTriangle<V, S> triangle = triangles[tri_i];
+                        tile_shader.set_vertex_states(&triangle.vs);
+                        dispatch_depth_format(opaque.depth_format, [&]<DepthFormat D>() {
+                            this->accumulate_triangle<D>(
+                                triangle, tile_shader, tile, opaque
+                            );
+                        });
+                        tile_shader.clear_vertex_states();
+                    }
+                }
+            });
+        }
+
+        // Composites the accumulated fragments over 'target', which needs to
+        // match the size of the buffer
+        void resolve(Surface& target) const;
+
+        private:
+        // the union of the bounds of all triangles drawn since the last clear
+        Rect covered;
+        // the indices of the triangles overlapping each tile
+        std::vector<std::vector<uint32_t>> bins;
+
+        void verify_size(const Surface& surface, const std::string& name) const;
+
+        template<DepthFormat D, typename V, typename S>
+        void accumulate_triangle(
+            ShadedTriangle<V, S>& triangle, S& shader, const Rect& tile,
+            const Surface& opaque
+        ) {
+            using Depth = DepthTraits<D>;
+            const typename Depth::Stored* opaque_depth
+                = (const typename Depth::Stored*) opaque.depth;
+            FloatColor* accum = (FloatColor*) this->accum.color;
+            FloatColor* revealage = (FloatColor*) this->revealage.color;
+            rasterize_triangle(
+                triangle, tile,
+                [&](int x, int y, double px_depth) {
+                    if(opaque_depth != nullptr) {
+                        typename Depth::Stored stored
+                            = opaque_depth[y * opaque.pitch + x];
+                        if(!Depth::passes(Depth::encode(px_depth), stored)) {
+                            return;
+                        }
+                    }
+                    Vec<4> fragment = shader.fragment();
+                    double alpha = std::clamp(fragment.a(), 0.0, 1.0);
+                    if(alpha == 0.0) { return; }
+                    double weight = transparency_weight(px_depth, alpha);
+                    FloatColor& px_accum = accum[y * this->accum.pitch + x];
+                    px_accum.r += (float) (fragment.r() * alpha * weight);
+                    px_accum.g += (float) (fragment.g() * alpha * weight);
+                    px_accum.b += (float) (fragment.b() * alpha * weight);
+                    px_accum.a += (float) (alpha * weight);
+                    revealage[y * this->revealage.pitch + x].r
+                        *= (float) (1.0 - alpha);
+                },
+                [](int y) { (void) y; }
+            );
+        }
+    };
+
+}
@@ -0,0 +1,78 @@
+
+#pragma once
+
+#include "rendering.hpp"
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace druck::video {
+
+    namespace rendering = druck::rendering;
+
+
+    enum Format {
+        Y4M, // YUV4MPEG2, 4:2:0 (BT.601, limited range)
+        RAW_RGBA // headerless RGBA8 frames, one after another
+    };
+
+    // Streams frames to a file or file descriptor (for example a pipe into
+    // an encoder). Frames are copied on 'write_frame' and converted and
+    // written on a separate thread, so the caller never waits for either.
+    // At most 'max_queued' frames are queued at once, further ones are
+    // dropped (callers that need every frame can 'flush' when
+    // 'queued_frames' reaches the limit).
+    struct Sink {
+        Sink(
+            const char* file, int width, int height, int fps,
+            Format format = Format::Y4M, size_t max_queued = 4
+        );
+        // The sink takes ownership of the file descriptor
+        Sink(
+            int file_descriptor, int width, int height, int fps,
+            Format format = Format::Y4M, size_t max_queued = 4
+        );
+        Sink(const Sink&) = delete;
+        Sink& operator=(const Sink& other) = delete;
+        // Writes all remaining frames before closing the output
+        ~Sink();
+
+        // Queues a copy of the frame, which needs to match the size of the
+        // sink. Returns false if the frame was dropped because the queue was
+        // full or an earlier frame could not be written.
+        bool write_frame(const rendering::Surface& frame);
+        // Blocks until all queued frames have been written. Returns false
+        // if any frame could not be written (after which no more frames are
+        // written, for example because the encoder has closed the pipe).
+        bool flush();
+        size_t queued_frames();
+
+        private:
+        std::FILE* output;
+        int width;
+        int height;
+        Format format;
+        size_t max_queued;
+        // frame copies are reused once written, and new ones are only
+        // allocated if all of them are still queued
+        std::vector<std::vector<rendering::Color>> free_frames;
+        std::deque<std::vector<rendering::Color>> queue;
+        // frames that have passed the queue limit but are still being
+        // copied (and not in 'queue' yet)
+        size_t reserved = 0;
+        std::mutex lock;
+        std::condition_variable frame_queued;
+        std::condition_variable frame_written;
+        bool writing = false;
+        bool failed = false;
+        bool stopping = false;
+        std::thread thread;
+
+        void start(int fps, size_t max_queued);
+        void run();
+    };
+
+}
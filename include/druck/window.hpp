@@ -1,8 +1,14 @@
 
 #pragma once
 
-#include <raylib.h>
 #include "rendering.hpp"
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 namespace druck::window {
 
@@ -15,4 +21,86 @@ namespace druck::window {
     void display_buffer(rendering::Surface& buffer);
     void close();
 
+#ifdef DRUCK_HEADLESS
+
+    // Without raylib, 'init' opens no window and displayed buffers are
+    // handed to the configured output instead.
+
+    enum Output {
+        DISCARD, // buffers are ignored
+        MEMORY, // the last buffer is kept (see 'last_frame')
+        PPM_SEQUENCE, // each buffer is written to '<prefix><frame>.ppm'
+        PNG_SEQUENCE // each buffer is written to '<prefix><frame>.png'
+    };
+
+    enum Timing {
+        FIXED, // 'delta_time' always returns 1 / fps
+        MEASURED, // 'delta_time' returns the measured time between frames
+        PACED // like 'MEASURED', but 'display_buffer' sleeps to reach the fps
+    };
+
+    void set_output(Output output, std::string path_prefix = "");
+    void set_timing(Timing timing);
+    // Makes 'should_close' return true once the given number of buffers
+    // has been displayed (0 means no limit)
+    void set_frame_limit(uint64_t frame_limit);
+    uint64_t frame_count();
+    // The last displayed buffer in RGBA8, if the output is 'MEMORY'
+    const std::vector<rendering::Color>& last_frame();
+
+#endif
+
+
+    // Presents buffers on a separate thread, so that the next frame can be
+    // rendered while the last one is being displayed.
+    // The presenting thread owns the window (opening it on construction and
+    // closing it on destruction), so 'init', 'should_close', 'delta_time',
+    // 'display_buffer' and 'close' must not be called while it exists.
+    struct Presenter {
+        Presenter(
+            const char* title, int width, int height, int fps,
+            int buffer_count = 2,
+            rendering::PixelFormat format = rendering::PixelFormat::RGBA8,
+            rendering::DepthFormat depth_format 
+                = rendering::DepthFormat::FLOAT32
+        );
+        Presenter(const Presenter&) = delete;
+        Presenter& operator=(const Presenter& other) = delete;
+        ~Presenter();
+
+        // Returns the next buffer that is neither queued nor being displayed,
+        // blocking until one becomes available
+        rendering::Surface& acquire();
+        // Queues a buffer returned by 'acquire' for presentation (fails if
+        // it has already been presented since)
+        void present(rendering::Surface& buffer);
+
+        bool should_close() const;
+        double delta_time() const;
+        int width() const;
+        int height() const;
+
+        private:
+        enum BufferState {
+            FREE, ACQUIRED, QUEUED, DISPLAYED
+        };
+
+        std::string title;
+        int fps;
+        std::vector<rendering::Surface> buffers;
+        std::vector<BufferState> states;
+        std::deque<size_t> queue;
+        std::mutex lock;
+        std::condition_variable buffer_freed;
+        std::condition_variable buffer_queued;
+        bool stopping = false;
+        std::atomic<bool> closing = false;
+        std::atomic<double> frame_time = 0.0;
+        std::atomic<int> window_width;
+        std::atomic<int> window_height;
+        std::thread thread;
+
+        void run();
+    };
+
 }
\ No newline at end of file
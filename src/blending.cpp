@@ -0,0 +1,152 @@
+
+#include <druck/blending.hpp>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace druck::blending {
+
+    // 'x' is a product of two 8-bit values
+    static int div255(int x) {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    static uint8_t saturate8(int x) {
+        return (uint8_t) std::min(x, 255);
+    }
+
+    static void blend_rgba8_scalar(
+        Mode mode, const Color* src, Color* dest, size_t count
+    ) {
+        for(size_t i = 0; i < count; i += 1) {
+            const uint8_t* s = (const uint8_t*) (src + i);
+            uint8_t* d = (uint8_t*) (dest + i);
+            int a = s[3];
+            for(int c = 0; c < 4; c += 1) {
+                bool alpha = c == 3;
+                switch(mode) {
+                    case Mode::REPLACE:
+                        d[c] = s[c];
+                        break;
+                    case Mode::ALPHA:
+                        d[c] = div255((alpha ? 255 : s[c]) * a + d[c] * (255 - a));
+                        break;
+                    case Mode::PREMULTIPLIED:
+                        d[c] = saturate8(s[c] + div255(d[c] * (255 - a)));
+                        break;
+                    case Mode::ADDITIVE:
+                        d[c] = saturate8(d[c] + div255(s[c] * (alpha ? 255 : a)));
+                        break;
+                    case Mode::MULTIPLY:
+                        if(!alpha) { d[c] = div255(s[c] * d[c]); }
+                        break;
+                }
+            }
+        }
+    }
+
+#ifdef __SSE2__
+    // 'x' holds 16-bit products of two 8-bit values
+    static __m128i div255_epi16(__m128i x) {
+        x = _mm_add_epi16(x, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    // Blends 2 pixels, widened to 16 bits per channel
+    static __m128i blend_epi16(Mode mode, __m128i s, __m128i d) {
+        const __m128i full = _mm_set1_epi16(255);
+        const __m128i alpha_lanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+        __m128i inv_a = _mm_sub_epi16(full, a);
+        switch(mode) {
+            case Mode::REPLACE:
+                return s;
+            case Mode::ALPHA:
+                // the source alpha lanes are treated as 1
+                s = _mm_or_si128(s, alpha_lanes);
+                return div255_epi16(_mm_add_epi16(
+                    _mm_mullo_epi16(s, a), _mm_mullo_epi16(d, inv_a)
+                ));
+            case Mode::PREMULTIPLIED:
+                return _mm_add_epi16(s, div255_epi16(_mm_mullo_epi16(d, inv_a)));
+            case Mode::ADDITIVE: {
+                // the alpha lanes are added as they are (factor 1)
+                __m128i factor = _mm_or_si128(
+                    _mm_andnot_si128(alpha_lanes, a), alpha_lanes
+                );
+                return _mm_add_epi16(d, div255_epi16(_mm_mullo_epi16(s, factor)));
+            }
+            case Mode::MULTIPLY:
+                // the source alpha lanes are treated as 1
+                s = _mm_or_si128(s, alpha_lanes);
+                return div255_epi16(_mm_mullo_epi16(s, d));
+        }
+        return s;
+    }
+#endif
+
+    void blend_rgba8(Mode mode, const Color* src, Color* dest, size_t count) {
+        if(mode == Mode::REPLACE) {
+            std::copy(src, src + count, dest);
+            return;
+        }
+        size_t i = 0;
+    #ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        for(; i + 4 <= count; i += 4) {
+            __m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+            __m128i d = _mm_loadu_si128((const __m128i*) (dest + i));
+            __m128i lo = blend_epi16(
+                mode, _mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero)
+            );
+            __m128i hi = blend_epi16(
+                mode, _mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero)
+            );
+            // packing saturates results above 255
+            _mm_storeu_si128((__m128i*) (dest + i), _mm_packus_epi16(lo, hi));
+        }
+    #endif
+        blend_rgba8_scalar(mode, src + i, dest + i, count - i);
+    }
+
+    void blend_floats(Mode mode, const float* src, float* dest, size_t count) {
+        for(size_t i = 0; i < count; i += 1) {
+            const float* s = src + i * 4;
+            float* d = dest + i * 4;
+            float a = s[3];
+            switch(mode) {
+                case Mode::REPLACE:
+                    for(int c = 0; c < 4; c += 1) { d[c] = s[c]; }
+                    break;
+                case Mode::ALPHA:
+                    for(int c = 0; c < 3; c += 1) { d[c] = s[c] * a + d[c] * (1 - a); }
+                    d[3] = a + d[3] * (1 - a);
+                    break;
+                case Mode::PREMULTIPLIED:
+                    for(int c = 0; c < 4; c += 1) { d[c] = s[c] + d[c] * (1 - a); }
+                    break;
+                case Mode::ADDITIVE:
+                    for(int c = 0; c < 3; c += 1) { d[c] += s[c] * a; }
+                    d[3] += a;
+                    break;
+                case Mode::MULTIPLY:
+                    for(int c = 0; c < 3; c += 1) { d[c] *= s[c]; }
+                    break;
+            }
+        }
+    }
+
+    Vec<4> blend(Mode mode, const Vec<4>& src, const Vec<4>& dest) {
+        float s[4] = {
+            (float) src.r(), (float) src.g(), (float) src.b(), (float) src.a()
+        };
+        float d[4] = {
+            (float) dest.r(), (float) dest.g(), (float) dest.b(), (float) dest.a()
+        };
+        blend_floats(mode, s, d, 1);
+        return Vec<4>(d[0], d[1], d[2], d[3]);
+    }
+
+}
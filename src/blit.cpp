@@ -0,0 +1,337 @@
+
+#include <druck/blit.hpp>
+#include <druck/threading.hpp>
+#include <druck/blending.hpp>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace druck::blit {
+
+    using namespace druck::math;
+    using rendering::Surface;
+    using rendering::Color;
+    using rendering::PixelFormat;
+    using rendering::PixelTraits;
+
+
+    // source positions are stepped in 16.16 fixed point
+    #define BLIT_FRACT_BITS 16
+    #define BLIT_ONE ((int64_t) 1 << BLIT_FRACT_BITS)
+    // bilinear weights for RGBA8 are 7 bits, so that the 16-bit
+    // intermediate products can't overflow
+    #define BLIT_WEIGHT_BITS 7
+    // rows are only split across threads in chunks of at least this size
+    #define BLIT_MIN_ROWS 16
+
+    struct Mapping {
+        // requested destination rectangle
+        int dest_x, dest_y;
+        int dest_width, dest_height;
+        // the part of it that is inside the destination
+        int start_x, end_x;
+        int start_y, end_y;
+        // source pixels per destination pixel
+        int64_t step_x, step_y;
+    };
+
+    // Source position of the first pixel of a row or column,
+    // relative to the requested destination rectangle
+    static int64_t nearest_start(int offset, int64_t step) {
+        return offset * step;
+    }
+
+    static int64_t bilinear_start(int offset, int64_t step) {
+        // sample at pixel centers
+        int64_t pos = offset * step + (step - BLIT_ONE) / 2;
+        return std::max(pos, (int64_t) 0);
+    }
+
+
+    template<typename T>
+    static void nearest_row(
+        const T* src_row, T* out, const Mapping& m, int src_width
+    ) {
+        int count = m.end_x - m.start_x;
+        int64_t pos = nearest_start(m.start_x - m.dest_x, m.step_x);
+        if(src_width == m.dest_width) {
+            // unscaled, copy the entire run
+            std::memcpy(out, src_row + (pos >> BLIT_FRACT_BITS), count * sizeof(T));
+            return;
+        }
+        for(int i = 0; i < count; i += 1) {
+            out[i] = src_row[pos >> BLIT_FRACT_BITS];
+            pos += m.step_x;
+        }
+    }
+
+    template<typename T>
+    static void nearest_rows(
+        const Surface& src, Surface& dest, const Mapping& m,
+        int y_start, int y_end
+    ) {
+        const T* src_color = (const T*) src.color;
+        T* dest_color = (T*) dest.color;
+        int count = m.end_x - m.start_x;
+        int last_src_y = -1;
+        const T* last_row = nullptr;
+        for(int y = y_start; y < y_end; y += 1) {
+            int64_t pos_y = nearest_start(y - m.dest_y, m.step_y);
+            int src_y = (int) (pos_y >> BLIT_FRACT_BITS);
+            T* dest_row = dest_color + (size_t) y * dest.pitch + m.start_x;
+            if(src_y == last_src_y) {
+                // when scaling up, rows repeat - copy the last one
+                std::memcpy(dest_row, last_row, count * sizeof(T));
+                continue;
+            }
+            nearest_row(
+                src_color + (size_t) src_y * src.pitch, dest_row, m, src.width
+            );
+            last_src_y = src_y;
+            last_row = dest_row;
+        }
+    }
+
+
+    static uint32_t load_pixel(const Color* pixel) {
+        uint32_t value;
+        std::memcpy(&value, pixel, sizeof(uint32_t));
+        return value;
+    }
+
+    static void bilinear_row_rgba8(
+        const Color* row0, const Color* row1, int weight_y,
+        Color* out, const Mapping& m, int src_width
+    ) {
+        int count = m.end_x - m.start_x;
+        int64_t pos = bilinear_start(m.start_x - m.dest_x, m.step_x);
+        int weight_shift = BLIT_FRACT_BITS - BLIT_WEIGHT_BITS;
+        int weight_mask = (1 << BLIT_WEIGHT_BITS) - 1;
+    #ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i wy = _mm_set1_epi16(weight_y);
+    #endif
+        for(int i = 0; i < count; i += 1) {
+            int x0 = (int) (pos >> BLIT_FRACT_BITS);
+            int x1 = std::min(x0 + 1, src_width - 1);
+            int weight_x = (int) (pos >> weight_shift) & weight_mask;
+            pos += m.step_x;
+    #ifdef __SSE2__
+            // lanes 0-3: left pixel, lanes 4-7: right pixel
+            __m128i top = _mm_unpacklo_epi8(_mm_unpacklo_epi32(
+                _mm_cvtsi32_si128(load_pixel(row0 + x0)),
+                _mm_cvtsi32_si128(load_pixel(row0 + x1))
+            ), zero);
+            __m128i bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi32(
+                _mm_cvtsi32_si128(load_pixel(row1 + x0)),
+                _mm_cvtsi32_si128(load_pixel(row1 + x1))
+            ), zero);
+            __m128i v = _mm_add_epi16(top, _mm_srai_epi16(
+                _mm_mullo_epi16(_mm_sub_epi16(bottom, top), wy),
+                BLIT_WEIGHT_BITS
+            ));
+            __m128i v_right = _mm_unpackhi_epi64(v, v);
+            __m128i h = _mm_add_epi16(v, _mm_srai_epi16(
+                _mm_mullo_epi16(
+                    _mm_sub_epi16(v_right, v), _mm_set1_epi16(weight_x)
+                ),
+                BLIT_WEIGHT_BITS
+            ));
+            uint32_t result = _mm_cvtsi128_si32(_mm_packus_epi16(h, zero));
+            std::memcpy(out + i, &result, sizeof(uint32_t));
+    #else
+            const uint8_t* p00 = (const uint8_t*) (row0 + x0);
+            const uint8_t* p10 = (const uint8_t*) (row0 + x1);
+            const uint8_t* p01 = (const uint8_t*) (row1 + x0);
+            const uint8_t* p11 = (const uint8_t*) (row1 + x1);
+            uint8_t* result = (uint8_t*) (out + i);
+            for(int c = 0; c < 4; c += 1) {
+                int left = p00[c]
+                    + (((p01[c] - p00[c]) * weight_y) >> BLIT_WEIGHT_BITS);
+                int right = p10[c]
+                    + (((p11[c] - p10[c]) * weight_y) >> BLIT_WEIGHT_BITS);
+                result[c] = (uint8_t) (
+                    left + (((right - left) * weight_x) >> BLIT_WEIGHT_BITS)
+                );
+            }
+    #endif
+        }
+    }
+
+    // Blends 'src' over 'dest' based on the alpha of 'src'
+    static void blit_rows_rgba8(
+        const Surface& src, Surface& dest, const Mapping& m,
+        Filter filter, bool alpha_blend, int y_start, int y_end
+    ) {
+        if(filter == Filter::NEAREST && !alpha_blend) {
+            nearest_rows<Color>(src, dest, m, y_start, y_end);
+            return;
+        }
+        const Color* src_color = (const Color*) src.color;
+        Color* dest_color = (Color*) dest.color;
+        int count = m.end_x - m.start_x;
+        thread_local std::vector<Color> sampled;
+        sampled.resize(count);
+        int weight_shift = BLIT_FRACT_BITS - BLIT_WEIGHT_BITS;
+        int weight_mask = (1 << BLIT_WEIGHT_BITS) - 1;
+        for(int y = y_start; y < y_end; y += 1) {
+            Color* dest_row = dest_color + (size_t) y * dest.pitch + m.start_x;
+            Color* out = alpha_blend ? sampled.data() : dest_row;
+            if(filter == Filter::NEAREST) {
+                int64_t pos_y = nearest_start(y - m.dest_y, m.step_y);
+                int src_y = (int) (pos_y >> BLIT_FRACT_BITS);
+                nearest_row(
+                    src_color + (size_t) src_y * src.pitch, out, m, src.width
+                );
+            } else {
+                int64_t pos_y = bilinear_start(y - m.dest_y, m.step_y);
+                int y0 = (int) (pos_y >> BLIT_FRACT_BITS);
+                int y1 = std::min(y0 + 1, src.height - 1);
+                int weight_y = (int) (pos_y >> weight_shift) & weight_mask;
+                bilinear_row_rgba8(
+                    src_color + (size_t) y0 * src.pitch,
+                    src_color + (size_t) y1 * src.pitch,
+                    weight_y, out, m, src.width
+                );
+            }
+            if(alpha_blend) {
+                blending::blend_rgba8(
+                    blending::Mode::ALPHA, sampled.data(), dest_row, count
+                );
+            }
+        }
+    }
+
+
+    template<PixelFormat S>
+    static Vec<4> read_src(const Surface& src, int x, int y) {
+        using Stored = typename PixelTraits<S>::Stored;
+        const Stored* color = (const Stored*) src.color;
+        return PixelTraits<S>::decode(color[(size_t) y * src.pitch + x]);
+    }
+
+    // Fallback for formats other than RGBA8, converting through floats
+    template<PixelFormat S, PixelFormat D>
+    static void blit_rows_generic(
+        const Surface& src, Surface& dest, const Mapping& m,
+        Filter filter, bool alpha_blend, int y_start, int y_end
+    ) {
+        using DestStored = typename PixelTraits<D>::Stored;
+        DestStored* dest_color = (DestStored*) dest.color;
+        double fract_scale = 1.0 / BLIT_ONE;
+        for(int y = y_start; y < y_end; y += 1) {
+            DestStored* dest_row = dest_color + (size_t) y * dest.pitch;
+            int64_t pos_y;
+            if(filter == Filter::NEAREST) {
+                pos_y = nearest_start(y - m.dest_y, m.step_y);
+            } else {
+                pos_y = bilinear_start(y - m.dest_y, m.step_y);
+            }
+            int y0 = (int) (pos_y >> BLIT_FRACT_BITS);
+            int y1 = std::min(y0 + 1, src.height - 1);
+            double weight_y = (pos_y & (BLIT_ONE - 1)) * fract_scale;
+            int64_t pos_x;
+            if(filter == Filter::NEAREST) {
+                pos_x = nearest_start(m.start_x - m.dest_x, m.step_x);
+            } else {
+                pos_x = bilinear_start(m.start_x - m.dest_x, m.step_x);
+            }
+            for(int x = m.start_x; x < m.end_x; x += 1) {
+                int x0 = (int) (pos_x >> BLIT_FRACT_BITS);
+                Vec<4> color;
+                if(filter == Filter::NEAREST) {
+                    color = read_src<S>(src, x0, y0);
+                } else {
+                    int x1 = std::min(x0 + 1, src.width - 1);
+                    double weight_x = (pos_x & (BLIT_ONE - 1)) * fract_scale;
+                    Vec<4> top = read_src<S>(src, x0, y0) * (1.0 - weight_x)
+                        + read_src<S>(src, x1, y0) * weight_x;
+                    Vec<4> bottom = read_src<S>(src, x0, y1) * (1.0 - weight_x)
+                        + read_src<S>(src, x1, y1) * weight_x;
+                    color = top * (1.0 - weight_y) + bottom * weight_y;
+                }
+                pos_x += m.step_x;
+                if(alpha_blend) {
+                    color = blending::blend(
+                        blending::Mode::ALPHA, color,
+                        PixelTraits<D>::decode(dest_row[x])
+                    );
+                }
+                dest_row[x] = PixelTraits<D>::encode(color);
+            }
+        }
+    }
+
+
+    void scaled(
+        const Surface& src, Surface& dest,
+        int dest_x, int dest_y, int dest_width, int dest_height,
+        Filter filter, bool alpha_blend
+    ) {
+        scaled(
+            src, dest, dest_x, dest_y, dest_width, dest_height,
+            { 0, 0, dest.width, dest.height }, filter, alpha_blend
+        );
+    }
+
+    void scaled(
+        const Surface& src, Surface& dest,
+        int dest_x, int dest_y, int dest_width, int dest_height,
+        const rendering::Rect& region,
+        Filter filter, bool alpha_blend
+    ) {
+        if(dest_width <= 0 || dest_height <= 0) { return; }
+        if(src.width <= 0 || src.height <= 0) { return; }
+        rendering::Rect written = region
+            .intersected({ 0, 0, dest.width, dest.height })
+            .intersected({ dest_x, dest_y, dest_width, dest_height });
+        if(written.is_empty()) { return; }
+        dest.mark_dirty(written);
+        Mapping m;
+        m.dest_x = dest_x;
+        m.dest_y = dest_y;
+        m.dest_width = dest_width;
+        m.dest_height = dest_height;
+        m.start_x = written.x;
+        m.end_x = written.x + written.width;
+        m.start_y = written.y;
+        m.end_y = written.y + written.height;
+        if(m.start_x >= m.end_x || m.start_y >= m.end_y) { return; }
+        m.step_x = ((int64_t) src.width << BLIT_FRACT_BITS) / dest_width;
+        m.step_y = ((int64_t) src.height << BLIT_FRACT_BITS) / dest_height;
+        bool both_rgba8 = src.format == PixelFormat::RGBA8
+            && dest.format == PixelFormat::RGBA8;
+        bool plain_copy = src.format == dest.format
+            && filter == Filter::NEAREST && !alpha_blend;
+        size_t row_count = m.end_y - m.start_y;
+        threading::parallel_for(row_count, BLIT_MIN_ROWS, [&](
+            size_t start, size_t end
+        ) {
+            int y_start = m.start_y + (int) start;
+            int y_end = m.start_y + (int) end;
+            if(both_rgba8) {
+                blit_rows_rgba8(
+                    src, dest, m, filter, alpha_blend, y_start, y_end
+                );
+            } else if(plain_copy) {
+                rendering::dispatch_pixel_format(src.format, [&]<PixelFormat P>() {
+                    using Stored = typename PixelTraits<P>::Stored;
+                    nearest_rows<Stored>(src, dest, m, y_start, y_end);
+                });
+            } else {
+                rendering::dispatch_pixel_format(src.format, [&]<PixelFormat S>() {
+                    rendering::dispatch_pixel_format(dest.format, [&]<PixelFormat D>() {
+                        blit_rows_generic<S, D>(
+                            src, dest, m, filter, alpha_blend, y_start, y_end
+                        );
+                    });
+                });
+            }
+        });
+    }
+
+}
@@ -0,0 +1,300 @@
+
+#include <druck/conversion.hpp>
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace druck::conversion {
+
+    // the encoding table is indexed by linear values quantized to 12 bits,
+    // which is enough to hit every 8-bit sRGB value
+    #define SRGB_ENCODE_LUT_SIZE 4096
+
+    static std::array<float, 256> build_unorm8_lut() {
+        std::array<float, 256> lut;
+        for(size_t i = 0; i < lut.size(); i += 1) {
+            lut[i] = i / 255.0f;
+        }
+        return lut;
+    }
+
+    static std::array<float, 256> build_srgb_decode_lut() {
+        std::array<float, 256> lut;
+        for(size_t i = 0; i < lut.size(); i += 1) {
+            double c = i / 255.0;
+            lut[i] = c <= 0.04045
+                ? c / 12.92
+                : std::pow((c + 0.055) / 1.055, 2.4);
+        }
+        return lut;
+    }
+
+    static std::array<uint8_t, SRGB_ENCODE_LUT_SIZE> build_srgb_encode_lut() {
+        std::array<uint8_t, SRGB_ENCODE_LUT_SIZE> lut;
+        for(size_t i = 0; i < lut.size(); i += 1) {
+            double l = (double) i / (SRGB_ENCODE_LUT_SIZE - 1);
+            double c = l <= 0.0031308
+                ? l * 12.92
+                : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+            lut[i] = (uint8_t) (c * 255.0 + 0.5);
+        }
+        return lut;
+    }
+
+    static const std::array<float, 256> unorm8_lut = build_unorm8_lut();
+    static const std::array<float, 256> srgb_decode_lut
+        = build_srgb_decode_lut();
+    static const std::array<uint8_t, SRGB_ENCODE_LUT_SIZE> srgb_encode_lut
+        = build_srgb_encode_lut();
+
+
+    // (rounds halfway values up, like 'pack_rgba8' does with SSE2)
+    static uint8_t saturate_unorm8(float value) {
+        // (also maps NaN to 0, see 'float_to_srgb8')
+        value = value > 0.0f ? value : 0.0f;
+        return (uint8_t) (std::min(value, 1.0f) * 255.0f + 0.5f);
+    }
+
+    void pack_rgba8(const float* src, Color* dest, size_t count) {
+        size_t i = 0;
+    #ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        for(; i + 4 <= count; i += 4) {
+            // one register per pixel, saturate and scale
+            __m128i p[4];
+            for(size_t j = 0; j < 4; j += 1) {
+                __m128 v = _mm_loadu_ps(src + (i + j) * 4);
+                // ('_mm_max_ps' returns the second operand for NaN)
+                v = _mm_min_ps(_mm_max_ps(v, zero), one);
+                // rounded the same way as 'saturate_unorm8' (truncating
+                // after adding 0.5, instead of rounding halfway values to
+                // even like '_mm_cvtps_epi32')
+                p[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half));
+            }
+            // narrow 4x4 32-bit values to 16 bytes
+            __m128i lo = _mm_packs_epi32(p[0], p[1]);
+            __m128i hi = _mm_packs_epi32(p[2], p[3]);
+            _mm_storeu_si128((__m128i*) (dest + i), _mm_packus_epi16(lo, hi));
+        }
+    #endif
+        for(; i < count; i += 1) {
+            const float* c = src + i * 4;
+            dest[i] = {
+                saturate_unorm8(c[0]), saturate_unorm8(c[1]),
+                saturate_unorm8(c[2]), saturate_unorm8(c[3])
+            };
+        }
+    }
+
+    void unpack_rgba8(const Color* src, float* dest, size_t count) {
+        size_t i = 0;
+    #ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+        for(; i + 4 <= count; i += 4) {
+            // widen 16 bytes to 4x4 32-bit values
+            __m128i bytes = _mm_loadu_si128((const __m128i*) (src + i));
+            __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+            __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+            __m128i p[4] = {
+                _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)
+            };
+            for(size_t j = 0; j < 4; j += 1) {
+                __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(p[j]), scale);
+                _mm_storeu_ps(dest + (i + j) * 4, v);
+            }
+        }
+    #endif
+        for(; i < count; i += 1) {
+            float* c = dest + i * 4;
+            c[0] = unorm8_lut[src[i].r];
+            c[1] = unorm8_lut[src[i].g];
+            c[2] = unorm8_lut[src[i].b];
+            c[3] = unorm8_lut[src[i].a];
+        }
+    }
+
+    void pack_srgb8(const float* src, Color* dest, size_t count) {
+        for(size_t i = 0; i < count; i += 1) {
+            const float* c = src + i * 4;
+            dest[i] = {
+                float_to_srgb8(c[0]), float_to_srgb8(c[1]),
+                float_to_srgb8(c[2]), saturate_unorm8(c[3])
+            };
+        }
+    }
+
+    void unpack_srgb8(const Color* src, float* dest, size_t count) {
+        for(size_t i = 0; i < count; i += 1) {
+            float* c = dest + i * 4;
+            c[0] = srgb_decode_lut[src[i].r];
+            c[1] = srgb_decode_lut[src[i].g];
+            c[2] = srgb_decode_lut[src[i].b];
+            c[3] = unorm8_lut[src[i].a];
+        }
+    }
+
+    float unorm8_to_float(uint8_t value) {
+        return unorm8_lut[value];
+    }
+
+    float srgb8_to_float(uint8_t value) {
+        return srgb_decode_lut[value];
+    }
+
+    uint8_t float_to_srgb8(float value) {
+        // (also maps NaN to 0, without 'std::isnan', which fast math
+        // options may assume to always be false)
+        value = value > 0.0f ? value : 0.0f;
+        float clamped = std::min(value, 1.0f);
+        size_t index = (size_t) (clamped * (SRGB_ENCODE_LUT_SIZE - 1) + 0.5f);
+        return srgb_encode_lut[index];
+    }
+
+
+
+    // BT.601 limited range coefficients, scaled by 256
+    static const int16_t y_coefs[3] = { 66, 129, 25 };
+    static const int16_t u_coefs[3] = { -38, -74, 112 };
+    static const int16_t v_coefs[3] = { 112, -94, -18 };
+
+    static uint8_t luma(Color c) {
+        int sum = y_coefs[0] * c.r + y_coefs[1] * c.g + y_coefs[2] * c.b;
+        return (uint8_t) (((sum + 128) >> 8) + 16);
+    }
+
+    // 'r', 'g' and 'b' are sums over 4 pixels
+    static uint8_t chroma(const int16_t coefs[3], int r, int g, int b) {
+        int sum = coefs[0] * r + coefs[1] * g + coefs[2] * b;
+        return (uint8_t) (((sum + 512) >> 10) + 128);
+    }
+
+#ifdef __SSE2__
+    // Multiplies 4 pixels of 16-bit RGBA in 'lo' and 'hi' with the given
+    // coefficients and returns the 4 per-pixel sums as 32-bit integers
+    static __m128i dot_rgb(__m128i lo, __m128i hi, __m128i coefs) {
+        // 'madd' yields 'cr * r + cg * g' and 'cb * b + 0 * a' per pixel
+        __m128 a = _mm_castsi128_ps(_mm_madd_epi16(lo, coefs));
+        __m128 b = _mm_castsi128_ps(_mm_madd_epi16(hi, coefs));
+        __m128i even = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i odd = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        return _mm_add_epi32(even, odd);
+    }
+
+    static __m128i coefs_vec(const int16_t coefs[3]) {
+        return _mm_setr_epi16(
+            coefs[0], coefs[1], coefs[2], 0, coefs[0], coefs[1], coefs[2], 0
+        );
+    }
+
+    // Sums up 2x2 blocks of 4 pixels in 'top' and 'bottom' (16-bit RGBA),
+    // giving the 16-bit RGBA sums of 2 blocks
+    static __m128i block_sums(__m128i top_lo, __m128i top_hi,
+            __m128i bottom_lo, __m128i bottom_hi) {
+        __m128i lo = _mm_add_epi16(top_lo, bottom_lo);
+        __m128i hi = _mm_add_epi16(top_hi, bottom_hi);
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        return _mm_unpacklo_epi64(lo, hi);
+    }
+#endif
+
+    void rgba8_to_yuv420(
+        const Color* src, int width, int height,
+        uint8_t* y, uint8_t* u, uint8_t* v
+    ) {
+        size_t chroma_width = (width + 1) / 2;
+    #ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i y_coefs_v = coefs_vec(y_coefs);
+        const __m128i u_coefs_v = coefs_vec(u_coefs);
+        const __m128i v_coefs_v = coefs_vec(v_coefs);
+        const __m128i y_round = _mm_set1_epi32(128);
+        const __m128i y_offset = _mm_set1_epi16(16);
+        const __m128i c_round = _mm_set1_epi32(512);
+        const __m128i c_offset = _mm_set1_epi16(128);
+    #endif
+        for(int row = 0; row < height; row += 1) {
+            const Color* line = src + (size_t) row * width;
+            uint8_t* y_line = y + (size_t) row * width;
+            int x = 0;
+        #ifdef __SSE2__
+            for(; x + 8 <= width; x += 8) {
+                __m128i a = _mm_loadu_si128((const __m128i*) (line + x));
+                __m128i b = _mm_loadu_si128((const __m128i*) (line + x + 4));
+                __m128i y0 = dot_rgb(
+                    _mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero),
+                    y_coefs_v
+                );
+                __m128i y1 = dot_rgb(
+                    _mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero),
+                    y_coefs_v
+                );
+                y0 = _mm_srai_epi32(_mm_add_epi32(y0, y_round), 8);
+                y1 = _mm_srai_epi32(_mm_add_epi32(y1, y_round), 8);
+                __m128i packed = _mm_add_epi16(_mm_packs_epi32(y0, y1), y_offset);
+                _mm_storel_epi64(
+                    (__m128i*) (y_line + x), _mm_packus_epi16(packed, packed)
+                );
+            }
+        #endif
+            for(; x < width; x += 1) {
+                y_line[x] = luma(line[x]);
+            }
+        }
+        for(int row = 0; row < height; row += 2) {
+            const Color* top = src + (size_t) row * width;
+            // the last row is repeated for odd heights
+            const Color* bottom = row + 1 < height ? top + width : top;
+            uint8_t* u_line = u + (row / 2) * chroma_width;
+            uint8_t* v_line = v + (row / 2) * chroma_width;
+            int x = 0;
+        #ifdef __SSE2__
+            for(; x + 8 <= width; x += 8) {
+                __m128i t0 = _mm_loadu_si128((const __m128i*) (top + x));
+                __m128i t1 = _mm_loadu_si128((const __m128i*) (top + x + 4));
+                __m128i b0 = _mm_loadu_si128((const __m128i*) (bottom + x));
+                __m128i b1 = _mm_loadu_si128((const __m128i*) (bottom + x + 4));
+                __m128i s0 = block_sums(
+                    _mm_unpacklo_epi8(t0, zero), _mm_unpackhi_epi8(t0, zero),
+                    _mm_unpacklo_epi8(b0, zero), _mm_unpackhi_epi8(b0, zero)
+                );
+                __m128i s1 = block_sums(
+                    _mm_unpacklo_epi8(t1, zero), _mm_unpackhi_epi8(t1, zero),
+                    _mm_unpacklo_epi8(b1, zero), _mm_unpackhi_epi8(b1, zero)
+                );
+                __m128i cu = dot_rgb(s0, s1, u_coefs_v);
+                __m128i cv = dot_rgb(s0, s1, v_coefs_v);
+                cu = _mm_srai_epi32(_mm_add_epi32(cu, c_round), 10);
+                cv = _mm_srai_epi32(_mm_add_epi32(cv, c_round), 10);
+                __m128i packed = _mm_add_epi16(_mm_packs_epi32(cu, cv), c_offset);
+                packed = _mm_packus_epi16(packed, packed);
+                int32_t u_bytes = _mm_cvtsi128_si32(packed);
+                int32_t v_bytes = _mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+                std::memcpy(u_line + x / 2, &u_bytes, 4);
+                std::memcpy(v_line + x / 2, &v_bytes, 4);
+            }
+        #endif
+            for(; x < width; x += 2) {
+                // the last column is repeated for odd widths
+                int right = x + 1 < width ? x + 1 : x;
+                Color c[4] = { top[x], top[right], bottom[x], bottom[right] };
+                int r = c[0].r + c[1].r + c[2].r + c[3].r;
+                int g = c[0].g + c[1].g + c[2].g + c[3].g;
+                int b = c[0].b + c[1].b + c[2].b + c[3].b;
+                u_line[x / 2] = chroma(u_coefs, r, g, b);
+                v_line[x / 2] = chroma(v_coefs, r, g, b);
+            }
+        }
+    }
+
+}
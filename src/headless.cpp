@@ -0,0 +1,148 @@
+
+#ifdef DRUCK_HEADLESS
+
+#include <druck/window.hpp>
+#include <druck/logging.hpp>
+#include <druck/image.hpp>
+#include <chrono>
+#include <cstdio>
+
+namespace druck::window {
+
+    using namespace druck::math;
+    using Clock = std::chrono::steady_clock;
+
+
+    static bool is_open = false;
+    static int window_width = 0;
+    static int window_height = 0;
+    static int target_fps = 60;
+    static Output output = Output::DISCARD;
+    static std::string output_prefix;
+    static Timing timing = Timing::FIXED;
+    static uint64_t frame_limit = 0;
+    static uint64_t frames = 0;
+    static double frame_time = 0.0;
+    static Clock::time_point last_display;
+    static std::vector<rendering::Color> memory_frame;
+    // the generation of the buffer 'memory_frame' was last copied from
+    static uint64_t memory_generation = 0;
+    static std::vector<rendering::Color> memory_staging;
+
+    void set_output(Output output, std::string path_prefix) {
+        window::output = output;
+        output_prefix = path_prefix;
+        memory_generation = 0;
+    }
+
+    void set_timing(Timing timing) { window::timing = timing; }
+
+    void set_frame_limit(uint64_t frame_limit) {
+        window::frame_limit = frame_limit;
+    }
+
+    uint64_t frame_count() { return frames; }
+
+    const std::vector<rendering::Color>& last_frame() { return memory_frame; }
+
+
+    void init(const char* title, int width, int height, int fps) {
+        logging::info(
+            "Running '" + std::string(title) + "' without a window ("
+                + std::to_string(width) + "x" + std::to_string(height) + ")"
+        );
+        is_open = true;
+        window_width = width;
+        window_height = height;
+        target_fps = fps > 0 ? fps : 60;
+        frames = 0;
+        frame_time = 1.0 / target_fps;
+        last_display = Clock::now();
+    }
+
+    bool should_close() {
+        return !is_open || (frame_limit != 0 && frames >= frame_limit);
+    }
+
+    int width() { return window_width; }
+    int height() { return window_height; }
+    Vec<2> size() { return Vec<2>(width(), height()); }
+
+    double delta_time() {
+        if(timing == Timing::FIXED) { return 1.0 / target_fps; }
+        return frame_time;
+    }
+
+    static std::string frame_file_name(const char* extension) {
+        char number[32];
+        std::snprintf(number, sizeof(number), "%06llu", (unsigned long long) frames);
+        return output_prefix + number + "." + extension;
+    }
+
+    static void update_memory_frame(rendering::Surface& buffer) {
+        size_t pixel_count = (size_t) buffer.width * buffer.height;
+        bool partial = memory_generation == buffer.generation
+            && memory_frame.size() == pixel_count;
+        memory_generation = buffer.generation;
+        if(!partial) {
+            memory_frame.resize(pixel_count);
+            buffer.read_colors(memory_frame.data());
+            return;
+        }
+        // only the dirty area changed since the buffer was last displayed
+        const rendering::Rect& area = buffer.dirty;
+        if(area.is_empty()) { return; }
+        std::vector<rendering::Color>& changed = memory_staging;
+        changed.resize((size_t) area.width * area.height);
+        buffer.read_colors(changed.data(), area);
+        for(int y = 0; y < area.height; y += 1) {
+            std::copy(
+                changed.begin() + (size_t) y * area.width,
+                changed.begin() + (size_t) (y + 1) * area.width,
+                memory_frame.begin()
+                    + (size_t) (area.y + y) * buffer.width + area.x
+            );
+        }
+    }
+
+    void display_buffer(rendering::Surface& buffer) {
+        switch(output) {
+            case Output::DISCARD: break;
+            case Output::MEMORY:
+                update_memory_frame(buffer);
+                break;
+            case Output::PPM_SEQUENCE:
+                image::write_file(
+                    frame_file_name("ppm"), image::encode_ppm(buffer)
+                );
+                break;
+            case Output::PNG_SEQUENCE:
+                image::write_file(
+                    frame_file_name("png"), image::encode_png(buffer)
+                );
+                break;
+        }
+        buffer.clear_dirty();
+        frames += 1;
+        if(timing == Timing::PACED) {
+            auto frame_end = last_display
+                + std::chrono::duration<double>(1.0 / target_fps);
+            std::this_thread::sleep_until(
+                std::chrono::time_point_cast<Clock::duration>(frame_end)
+            );
+        }
+        Clock::time_point now = Clock::now();
+        frame_time = std::chrono::duration<double>(now - last_display).count();
+        last_display = now;
+    }
+
+    void close() {
+        is_open = false;
+        memory_frame.clear();
+        memory_frame.shrink_to_fit();
+        memory_generation = 0;
+    }
+
+}
+
+#endif
@@ -0,0 +1,872 @@
+
+#include <druck/image.hpp>
+#include <druck/logging.hpp>
+#include <fstream>
+#include <cstring>
+#include <array>
+#include <memory>
+#include <cstdint>
+
+namespace druck::image {
+
+    namespace logging = druck::logging;
+    using rendering::Color;
+
+
+    static const uint8_t png_signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+
+    static std::array<uint32_t, 256> build_crc_table() {
+        std::array<uint32_t, 256> table;
+        for(uint32_t n = 0; n < 256; n += 1) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k += 1) {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }
+
+    static const std::array<uint32_t, 256> crc_table = build_crc_table();
+
+    static uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc) {
+        crc ^= 0xFFFFFFFF;
+        for(size_t i = 0; i < length; i += 1) {
+            crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    static uint32_t adler32(const uint8_t* data, size_t length) {
+        uint32_t a = 1;
+        uint32_t b = 0;
+        for(size_t i = 0; i < length; i += 1) {
+            a = (a + data[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    static void push_u32_be(std::vector<uint8_t>& out, uint32_t value) {
+        out.push_back(value >> 24);
+        out.push_back(value >> 16);
+        out.push_back(value >> 8);
+        out.push_back(value);
+    }
+
+    static uint32_t read_u32_be(const uint8_t* data) {
+        return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16)
+            | ((uint32_t) data[2] << 8) | (uint32_t) data[3];
+    }
+
+    static void push_png_chunk(
+        std::vector<uint8_t>& out, const char type[4],
+        const uint8_t* data, size_t length
+    ) {
+        push_u32_be(out, length);
+        size_t type_start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + length);
+        uint32_t crc = crc32(out.data() + type_start, length + 4, 0);
+        push_u32_be(out, crc);
+    }
+
+
+    std::vector<uint8_t> encode_ppm(const Color* pixels, int width, int height) {
+        std::string header = "P6\n" + std::to_string(width) + " "
+            + std::to_string(height) + "\n255\n";
+        std::vector<uint8_t> out(header.begin(), header.end());
+        out.reserve(out.size() + (size_t) width * height * 3);
+        for(size_t i = 0; i < (size_t) width * height; i += 1) {
+            out.push_back(pixels[i].r);
+            out.push_back(pixels[i].g);
+            out.push_back(pixels[i].b);
+        }
+        return out;
+    }
+
+    std::vector<uint8_t> encode_ppm(const rendering::Surface& surface) {
+        std::vector<Color> pixels(surface.width * surface.height);
+        surface.read_colors(pixels.data());
+        return encode_ppm(pixels.data(), surface.width, surface.height);
+    }
+
+    std::vector<uint8_t> encode_png(const rendering::Surface& surface) {
+        std::vector<Color> pixels(surface.width * surface.height);
+        surface.read_colors(pixels.data());
+        return encode_png(pixels.data(), surface.width, surface.height);
+    }
+
+    static bool try_write_file(
+        const std::string& file, const std::vector<uint8_t>& data
+    ) {
+        auto stream = std::ofstream(file, std::ios::binary);
+        stream.write((const char*) data.data(), data.size());
+        return !stream.fail();
+    }
+
+    void write_file(const std::string& file, const std::vector<uint8_t>& data) {
+        if(!try_write_file(file, data)) {
+            logging::error("The file '" + file + "' could not be written");
+        }
+    }
+
+
+    Writer::Writer(size_t max_queued) {
+        this->max_queued = std::max(max_queued, (size_t) 1);
+        this->thread = std::thread([this]() { this->run(); });
+    }
+
+    Writer::~Writer() {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->snapshot_queued.notify_all();
+        this->thread.join();
+    }
+
+    std::future<bool> Writer::save_png(
+        const rendering::Surface& surface, std::string file
+    ) {
+        auto result = std::make_shared<std::promise<bool>>();
+        std::future<bool> future = result->get_future();
+        this->save_png(surface, std::move(file), [result](bool written) {
+            result->set_value(written);
+        });
+        return future;
+    }
+
+    void Writer::save_png(
+        const rendering::Surface& surface, std::string file,
+        std::function<void(bool)> done
+    ) {
+        std::vector<Color> pixels;
+        bool rejected = false;
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            if(this->queue.size() + this->reserved >= this->max_queued) {
+                rejected = true;
+            } else {
+                // (keeps the slot while the pixels are copied)
+                this->reserved += 1;
+                if(this->free_buffers.size() > 0) {
+                    pixels = std::move(this->free_buffers.back());
+                    this->free_buffers.pop_back();
+                }
+            }
+        }
+        // (called without holding the lock, since it may use the writer)
+        if(rejected) {
+            logging::warning(
+                "Too many images are already queued, '" + file
+                    + "' will not be written"
+            );
+            done(false);
+            return;
+        }
+        pixels.resize((size_t) surface.width * surface.height);
+        surface.read_colors(pixels.data());
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->reserved -= 1;
+            this->queue.push_back({
+                std::move(pixels), surface.width, surface.height,
+                std::move(file), std::move(done)
+            });
+        }
+        this->snapshot_queued.notify_one();
+    }
+
+    size_t Writer::queued() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->queue.size() + this->reserved + (this->writing ? 1 : 0);
+    }
+
+    void Writer::run() {
+        for(;;) {
+            Snapshot snapshot;
+            {
+                std::unique_lock<std::mutex> guard(this->lock);
+                this->snapshot_queued.wait(guard, [&]() {
+                    return this->stopping || this->queue.size() > 0;
+                });
+                if(this->queue.size() == 0) { return; }
+                snapshot = std::move(this->queue.front());
+                this->queue.pop_front();
+                this->writing = true;
+            }
+            std::vector<uint8_t> data = encode_png(
+                snapshot.pixels.data(), snapshot.width, snapshot.height
+            );
+            bool written = try_write_file(snapshot.file, data);
+            if(!written) {
+                logging::warning(
+                    "The file '" + snapshot.file + "' could not be written"
+                );
+            }
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                this->free_buffers.push_back(std::move(snapshot.pixels));
+                this->writing = false;
+            }
+            snapshot.done(written);
+        }
+    }
+
+
+    // Inflate (RFC 1951), decoding Huffman codes bit by bit
+    // using canonical code counts
+
+    struct BitReader {
+        const uint8_t* data;
+        size_t size;
+        const std::string& name;
+        size_t pos = 0;
+        uint32_t buffer = 0;
+        int count = 0;
+
+        uint32_t bits(int n) {
+            while(this->count < n) {
+                if(this->pos >= this->size) {
+                    logging::error(
+                        "Unexpected end of compressed data in '"
+                            + this->name + "'"
+                    );
+                }
+                this->buffer |= (uint32_t) this->data[this->pos] << this->count;
+                this->pos += 1;
+                this->count += 8;
+            }
+            uint32_t value = this->buffer & ((1u << n) - 1);
+            this->buffer >>= n;
+            this->count -= n;
+            return value;
+        }
+
+        void align() {
+            this->buffer = 0;
+            this->count = 0;
+        }
+    };
+
+    struct Huffman {
+        uint16_t counts[16];
+        uint16_t symbols[288];
+    };
+
+    static void build_huffman(Huffman& h, const uint8_t* lengths, int n) {
+        std::memset(h.counts, 0, sizeof(h.counts));
+        for(int symbol = 0; symbol < n; symbol += 1) {
+            h.counts[lengths[symbol]] += 1;
+        }
+        h.counts[0] = 0;
+        uint16_t offsets[16];
+        offsets[1] = 0;
+        for(int length = 1; length < 15; length += 1) {
+            offsets[length + 1] = offsets[length] + h.counts[length];
+        }
+        for(int symbol = 0; symbol < n; symbol += 1) {
+            if(lengths[symbol] == 0) { continue; }
+            h.symbols[offsets[lengths[symbol]]] = symbol;
+            offsets[lengths[symbol]] += 1;
+        }
+    }
+
+    static int decode_symbol(BitReader& in, const Huffman& h) {
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for(int length = 1; length < 16; length += 1) {
+            code |= in.bits(1);
+            int count = h.counts[length];
+            if(code - count < first) {
+                return h.symbols[index + (code - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        logging::error("Invalid Huffman code in '" + in.name + "'");
+        return -1;
+    }
+
+    static const uint16_t length_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const uint8_t length_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const uint16_t dist_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577
+    };
+    static const uint8_t dist_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    static void inflate_codes(
+        BitReader& in, std::vector<uint8_t>& out,
+        const Huffman& lengths, const Huffman& distances
+    ) {
+        for(;;) {
+            int symbol = decode_symbol(in, lengths);
+            if(symbol < 256) {
+                out.push_back(symbol);
+                continue;
+            }
+            if(symbol == 256) { return; }
+            symbol -= 257;
+            if(symbol >= 29) {
+                logging::error("Invalid length code in '" + in.name + "'");
+            }
+            size_t length = length_base[symbol] + in.bits(length_extra[symbol]);
+            int dist_symbol = decode_symbol(in, distances);
+            if(dist_symbol >= 30) {
+                logging::error("Invalid distance code in '" + in.name + "'");
+            }
+            size_t dist = dist_base[dist_symbol]
+                + in.bits(dist_extra[dist_symbol]);
+            if(dist > out.size()) {
+                logging::error("Invalid distance in '" + in.name + "'");
+            }
+            size_t start = out.size() - dist;
+            for(size_t i = 0; i < length; i += 1) {
+                out.push_back(out[start + i]);
+            }
+        }
+    }
+
+    static void inflate_dynamic_tables(
+        BitReader& in, Huffman& lengths, Huffman& distances
+    ) {
+        static const uint8_t order[19] = {
+            16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+        };
+        int length_count = in.bits(5) + 257;
+        int dist_count = in.bits(5) + 1;
+        int code_count = in.bits(4) + 4;
+        if(length_count > 286 || dist_count > 30) {
+            logging::error("Invalid code counts in '" + in.name + "'");
+        }
+        uint8_t code_lengths[19] = {};
+        for(int i = 0; i < code_count; i += 1) {
+            code_lengths[order[i]] = in.bits(3);
+        }
+        Huffman codes;
+        build_huffman(codes, code_lengths, 19);
+        uint8_t all_lengths[286 + 30] = {};
+        int index = 0;
+        while(index < length_count + dist_count) {
+            int symbol = decode_symbol(in, codes);
+            if(symbol < 16) {
+                all_lengths[index] = symbol;
+                index += 1;
+                continue;
+            }
+            uint8_t repeated = 0;
+            int repeat;
+            if(symbol == 16) {
+                if(index == 0) {
+                    logging::error("Invalid code lengths in '" + in.name + "'");
+                }
+                repeated = all_lengths[index - 1];
+                repeat = 3 + in.bits(2);
+            } else if(symbol == 17) {
+                repeat = 3 + in.bits(3);
+            } else {
+                repeat = 11 + in.bits(7);
+            }
+            if(index + repeat > length_count + dist_count) {
+                logging::error("Invalid code lengths in '" + in.name + "'");
+            }
+            for(int i = 0; i < repeat; i += 1) {
+                all_lengths[index] = repeated;
+                index += 1;
+            }
+        }
+        build_huffman(lengths, all_lengths, length_count);
+        build_huffman(distances, all_lengths + length_count, dist_count);
+    }
+
+    static std::vector<uint8_t> zlib_inflate(
+        const std::vector<uint8_t>& data, const std::string& name
+    ) {
+        if(data.size() < 6 || (data[0] & 0x0F) != 8) {
+            logging::error("Invalid zlib stream in '" + name + "'");
+        }
+        BitReader in = { data.data(), data.size() - 4, name };
+        in.pos = 2; // skip the zlib header
+        std::vector<uint8_t> out;
+        bool last = false;
+        while(!last) {
+            last = in.bits(1);
+            int type = in.bits(2);
+            if(type == 0) {
+                in.align();
+                if(in.pos + 4 > in.size) {
+                    logging::error("Invalid stored block in '" + name + "'");
+                }
+                size_t length = data[in.pos] | (data[in.pos + 1] << 8);
+                in.pos += 4;
+                if(in.pos + length > in.size) {
+                    logging::error("Invalid stored block in '" + name + "'");
+                }
+                out.insert(
+                    out.end(), data.begin() + in.pos,
+                    data.begin() + in.pos + length
+                );
+                in.pos += length;
+            } else if(type == 1) {
+                static Huffman fixed_lengths;
+                static Huffman fixed_distances;
+                static bool fixed_built = false;
+                if(!fixed_built) {
+                    uint8_t lengths[288];
+                    for(int i = 0; i < 288; i += 1) {
+                        lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+                    }
+                    build_huffman(fixed_lengths, lengths, 288);
+                    uint8_t distances[30];
+                    std::memset(distances, 5, sizeof(distances));
+                    build_huffman(fixed_distances, distances, 30);
+                    fixed_built = true;
+                }
+                inflate_codes(in, out, fixed_lengths, fixed_distances);
+            } else if(type == 2) {
+                Huffman lengths;
+                Huffman distances;
+                inflate_dynamic_tables(in, lengths, distances);
+                inflate_codes(in, out, lengths, distances);
+            } else {
+                logging::error("Invalid block type in '" + name + "'");
+            }
+        }
+        return out;
+    }
+
+
+    // Deflate (RFC 1951) using the fixed Huffman codes, with matches found
+    // through hash chains over the last 32 KiB
+
+    #define DEFLATE_WINDOW_SIZE 32768
+    #define DEFLATE_HASH_BITS 15
+    #define DEFLATE_MAX_CHAIN 32
+    #define DEFLATE_MIN_MATCH 3
+    #define DEFLATE_MAX_MATCH 258
+
+    struct BitWriter {
+        std::vector<uint8_t>& out;
+        uint32_t buffer = 0;
+        int count = 0;
+
+        void bits(uint32_t value, int n) {
+            this->buffer |= value << this->count;
+            this->count += n;
+            while(this->count >= 8) {
+                this->out.push_back(this->buffer & 0xFF);
+                this->buffer >>= 8;
+                this->count -= 8;
+            }
+        }
+
+        // Huffman codes are stored starting with their most significant bit
+        void code(uint32_t code, int n) {
+            uint32_t reversed = 0;
+            for(int i = 0; i < n; i += 1) {
+                reversed = (reversed << 1) | ((code >> i) & 1);
+            }
+            this->bits(reversed, n);
+        }
+
+        void finish() {
+            if(this->count > 0) { this->out.push_back(this->buffer & 0xFF); }
+            this->buffer = 0;
+            this->count = 0;
+        }
+    };
+
+    static void write_fixed_literal(BitWriter& out, int symbol) {
+        if(symbol < 144) { out.code(0x30 + symbol, 8); }
+        else if(symbol < 256) { out.code(0x190 + symbol - 144, 9); }
+        else if(symbol < 280) { out.code(symbol - 256, 7); }
+        else { out.code(0xC0 + symbol - 280, 8); }
+    }
+
+    static void write_match(BitWriter& out, size_t length, size_t dist) {
+        int length_symbol = 28;
+        while(length_base[length_symbol] > length) { length_symbol -= 1; }
+        write_fixed_literal(out, 257 + length_symbol);
+        out.bits(length - length_base[length_symbol], length_extra[length_symbol]);
+        int dist_symbol = 29;
+        while(dist_base[dist_symbol] > dist) { dist_symbol -= 1; }
+        out.code(dist_symbol, 5);
+        out.bits(dist - dist_base[dist_symbol], dist_extra[dist_symbol]);
+    }
+
+    static uint32_t hash3(const uint8_t* data) {
+        uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+        return (value * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+    }
+
+    static std::vector<uint8_t> zlib_deflate(const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> out = { 0x78, 0x01 };
+        BitWriter writer = { out };
+        writer.bits(1, 1); // last block
+        writer.bits(1, 2); // fixed Huffman codes
+        // most recent position for each hash and the previous position with
+        // the same hash for each position in the window (+1, 0 = none)
+        std::vector<uint32_t> head(1 << DEFLATE_HASH_BITS, 0);
+        std::vector<uint32_t> prev(DEFLATE_WINDOW_SIZE, 0);
+        auto insert = [&](size_t pos) {
+            uint32_t hash = hash3(data.data() + pos);
+            prev[pos % DEFLATE_WINDOW_SIZE] = head[hash];
+            head[hash] = pos + 1;
+        };
+        size_t pos = 0;
+        while(pos < data.size()) {
+            size_t best_length = 0;
+            size_t best_dist = 0;
+            if(pos + DEFLATE_MIN_MATCH <= data.size()) {
+                size_t max_length = std::min(
+                    data.size() - pos, (size_t) DEFLATE_MAX_MATCH
+                );
+                uint32_t candidate = head[hash3(data.data() + pos)];
+                for(int chain = 0; chain < DEFLATE_MAX_CHAIN; chain += 1) {
+                    if(candidate == 0) { break; }
+                    size_t match = candidate - 1;
+                    if(pos - match > DEFLATE_WINDOW_SIZE) { break; }
+                    size_t length = 0;
+                    while(length < max_length
+                        && data[match + length] == data[pos + length]) {
+                        length += 1;
+                    }
+                    if(length > best_length) {
+                        best_length = length;
+                        best_dist = pos - match;
+                        if(length == max_length) { break; }
+                    }
+                    uint32_t next = prev[match % DEFLATE_WINDOW_SIZE];
+                    // stop once the chain leaves the window
+                    if(next == 0 || next - 1 >= match) { break; }
+                    candidate = next;
+                }
+            }
+            if(best_length >= DEFLATE_MIN_MATCH) {
+                write_match(writer, best_length, best_dist);
+                size_t end = pos + best_length;
+                for(; pos < end; pos += 1) {
+                    if(pos + DEFLATE_MIN_MATCH <= data.size()) { insert(pos); }
+                }
+            } else {
+                write_fixed_literal(writer, data[pos]);
+                if(pos + DEFLATE_MIN_MATCH <= data.size()) { insert(pos); }
+                pos += 1;
+            }
+        }
+        write_fixed_literal(writer, 256);
+        writer.finish();
+        push_u32_be(out, adler32(data.data(), data.size()));
+        return out;
+    }
+
+
+    static uint8_t paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = abs(p - a);
+        int pb = abs(p - b);
+        int pc = abs(p - c);
+        if(pa <= pb && pa <= pc) { return a; }
+        if(pb <= pc) { return b; }
+        return c;
+    }
+
+    static void unfilter_png(
+        std::vector<uint8_t>& raw, size_t row_size, int height,
+        size_t pixel_size, const std::string& name
+    ) {
+        if(raw.size() < (row_size + 1) * height) {
+            logging::error("Not enough image data in '" + name + "'");
+        }
+        for(int y = 0; y < height; y += 1) {
+            uint8_t* row = raw.data() + y * (row_size + 1);
+            uint8_t filter = row[0];
+            row += 1;
+            const uint8_t* prev = y > 0 ? row - (row_size + 1) : nullptr;
+            for(size_t i = 0; i < row_size; i += 1) {
+                int a = i >= pixel_size ? row[i - pixel_size] : 0;
+                int b = prev != nullptr ? prev[i] : 0;
+                int c = prev != nullptr && i >= pixel_size
+                    ? prev[i - pixel_size] : 0;
+                switch(filter) {
+                    case 0: break;
+                    case 1: row[i] += a; break;
+                    case 2: row[i] += b; break;
+                    case 3: row[i] += (a + b) / 2; break;
+                    case 4: row[i] += paeth(a, b, c); break;
+                    default:
+                        logging::error(
+                            "Invalid PNG filter type in '" + name + "'"
+                        );
+                }
+            }
+        }
+    }
+
+    // Filters each row with the filter type that gives the smallest sum of
+    // absolute (signed) differences, which usually compresses best
+    static std::vector<uint8_t> filter_png(
+        const uint8_t* pixels, size_t row_size, int height, size_t pixel_size
+    ) {
+        std::vector<uint8_t> raw((row_size + 1) * height);
+        std::vector<uint8_t> candidate(row_size);
+        for(int y = 0; y < height; y += 1) {
+            const uint8_t* row = pixels + y * row_size;
+            const uint8_t* prev = y > 0 ? row - row_size : nullptr;
+            uint8_t* dest = raw.data() + y * (row_size + 1);
+            size_t best_cost = SIZE_MAX;
+            for(uint8_t filter = 0; filter <= 4; filter += 1) {
+                if(prev == nullptr && (filter == 2 || filter == 4)) { continue; }
+                size_t cost = 0;
+                for(size_t i = 0; i < row_size; i += 1) {
+                    int a = i >= pixel_size ? row[i - pixel_size] : 0;
+                    int b = prev != nullptr ? prev[i] : 0;
+                    int c = prev != nullptr && i >= pixel_size
+                        ? prev[i - pixel_size] : 0;
+                    uint8_t predicted = 0;
+                    switch(filter) {
+                        case 1: predicted = a; break;
+                        case 2: predicted = b; break;
+                        case 3: predicted = (a + b) / 2; break;
+                        case 4: predicted = paeth(a, b, c); break;
+                    }
+                    candidate[i] = row[i] - predicted;
+                    cost += abs((int8_t) candidate[i]);
+                }
+                if(cost < best_cost) {
+                    best_cost = cost;
+                    dest[0] = filter;
+                    std::memcpy(dest + 1, candidate.data(), row_size);
+                }
+            }
+        }
+        return raw;
+    }
+
+    std::vector<uint8_t> encode_png(const Color* pixels, int width, int height) {
+        std::vector<uint8_t> out(png_signature, png_signature + 8);
+        uint8_t ihdr[13];
+        uint32_t w = width;
+        uint32_t h = height;
+        uint8_t size[8] = {
+            (uint8_t) (w >> 24), (uint8_t) (w >> 16), (uint8_t) (w >> 8), (uint8_t) w,
+            (uint8_t) (h >> 24), (uint8_t) (h >> 16), (uint8_t) (h >> 8), (uint8_t) h
+        };
+        std::memcpy(ihdr, size, 8);
+        ihdr[8] = 8; // bit depth
+        ihdr[9] = 6; // color type (RGBA)
+        ihdr[10] = 0; // compression method (deflate)
+        ihdr[11] = 0; // filter method
+        ihdr[12] = 0; // no interlacing
+        push_png_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+        std::vector<uint8_t> raw = filter_png(
+            (const uint8_t*) pixels, (size_t) width * 4, height, 4
+        );
+        std::vector<uint8_t> compressed = zlib_deflate(raw);
+        push_png_chunk(out, "IDAT", compressed.data(), compressed.size());
+        push_png_chunk(out, "IEND", nullptr, 0);
+        return out;
+    }
+
+
+    static rendering::Surface decode_png(
+        const std::vector<uint8_t>& data, const std::string& name
+    ) {
+        int width = 0;
+        int height = 0;
+        int bit_depth = 0;
+        int color_type = 0;
+        std::vector<uint8_t> palette;
+        std::vector<uint8_t> palette_alpha;
+        std::vector<uint8_t> compressed;
+        size_t pos = 8;
+        while(pos + 8 <= data.size()) {
+            uint32_t length = read_u32_be(data.data() + pos);
+            std::string type((const char*) data.data() + pos + 4, 4);
+            const uint8_t* chunk = data.data() + pos + 8;
+            if(pos + 12 + length > data.size()) {
+                logging::error("Truncated PNG chunk in '" + name + "'");
+            }
+            if(type == "IHDR") {
+                width = read_u32_be(chunk);
+                height = read_u32_be(chunk + 4);
+                bit_depth = chunk[8];
+                color_type = chunk[9];
+                if(chunk[12] != 0) {
+                    logging::error(
+                        "The file '" + name + "' is interlaced"
+                            ", which is currently not supported"
+                    );
+                }
+            } else if(type == "PLTE") {
+                palette.assign(chunk, chunk + length);
+            } else if(type == "tRNS") {
+                palette_alpha.assign(chunk, chunk + length);
+            } else if(type == "IDAT") {
+                compressed.insert(compressed.end(), chunk, chunk + length);
+            } else if(type == "IEND") {
+                break;
+            }
+            pos += 12 + length;
+        }
+        bool depth_supported = bit_depth == 8
+            || (bit_depth == 16 && color_type != 3);
+        if(!depth_supported) {
+            logging::error(
+                "The file '" + name + "' uses a bit depth of "
+                    + std::to_string(bit_depth)
+                    + ", which is currently not supported"
+            );
+        }
+        size_t channels;
+        switch(color_type) {
+            case 0: channels = 1; break; // gray
+            case 2: channels = 3; break; // RGB
+            case 3: channels = 1; break; // palette
+            case 4: channels = 2; break; // gray + alpha
+            case 6: channels = 4; break; // RGBA
+            default:
+                logging::error("Invalid PNG color type in '" + name + "'");
+                return rendering::Surface(1, 1);
+        }
+        size_t bytes_per_channel = bit_depth / 8;
+        size_t pixel_size = channels * bytes_per_channel;
+        size_t row_size = width * pixel_size;
+        std::vector<uint8_t> raw = zlib_inflate(compressed, name);
+        unfilter_png(raw, row_size, height, pixel_size, name);
+        std::vector<Color> pixels((size_t) width * height);
+        for(int y = 0; y < height; y += 1) {
+            const uint8_t* row = raw.data() + y * (row_size + 1) + 1;
+            for(int x = 0; x < width; x += 1) {
+                // only the most significant byte of 16-bit channels is used
+                const uint8_t* p = row + x * pixel_size;
+                auto channel = [&](size_t c) {
+                    return p[c * bytes_per_channel];
+                };
+                Color& color = pixels[(size_t) y * width + x];
+                switch(color_type) {
+                    case 0:
+                        color = { channel(0), channel(0), channel(0), 255 };
+                        break;
+                    case 2:
+                        color = { channel(0), channel(1), channel(2), 255 };
+                        break;
+                    case 3: {
+                        size_t index = p[0];
+                        if(index * 3 + 2 >= palette.size()) {
+                            logging::error(
+                                "Invalid palette index in '" + name + "'"
+                            );
+                        }
+                        uint8_t alpha = index < palette_alpha.size()
+                            ? palette_alpha[index] : 255;
+                        color = {
+                            palette[index * 3], palette[index * 3 + 1],
+                            palette[index * 3 + 2], alpha
+                        };
+                        break;
+                    }
+                    case 4:
+                        color = { channel(0), channel(0), channel(0), channel(1) };
+                        break;
+                    case 6:
+                        color = { channel(0), channel(1), channel(2), channel(3) };
+                        break;
+                }
+            }
+        }
+        return rendering::Surface(pixels.data(), nullptr, width, height);
+    }
+
+    static rendering::Surface decode_ppm(
+        const std::vector<uint8_t>& data, const std::string& name
+    ) {
+        // header: 'P6', width, height and maximum value, separated by
+        // whitespace (and possibly comments)
+        size_t pos = 2;
+        int values[3];
+        for(int value_i = 0; value_i < 3; value_i += 1) {
+            for(;;) {
+                if(pos >= data.size()) {
+                    logging::error("Truncated PPM header in '" + name + "'");
+                }
+                if(data[pos] == '#') {
+                    while(pos < data.size() && data[pos] != '\n') { pos += 1; }
+                } else if(isspace(data[pos])) {
+                    pos += 1;
+                } else { break; }
+            }
+            values[value_i] = 0;
+            while(pos < data.size() && isdigit(data[pos])) {
+                values[value_i] = values[value_i] * 10 + (data[pos] - '0');
+                pos += 1;
+            }
+        }
+        pos += 1; // single whitespace character before the pixel data
+        int width = values[0];
+        int height = values[1];
+        if(values[2] != 255) {
+            logging::error(
+                "The file '" + name + "' uses a maximum value of "
+                    + std::to_string(values[2])
+                    + ", which is currently not supported"
+            );
+        }
+        if(pos + (size_t) width * height * 3 > data.size()) {
+            logging::error("Not enough image data in '" + name + "'");
+        }
+        std::vector<Color> pixels((size_t) width * height);
+        for(size_t i = 0; i < pixels.size(); i += 1) {
+            const uint8_t* p = data.data() + pos + i * 3;
+            pixels[i] = { p[0], p[1], p[2], 255 };
+        }
+        return rendering::Surface(pixels.data(), nullptr, width, height);
+    }
+
+    rendering::Surface decode(
+        const std::vector<uint8_t>& data, const std::string& name
+    ) {
+        if(data.size() >= 8 && std::memcmp(data.data(), png_signature, 8) == 0) {
+            return decode_png(data, name);
+        }
+        if(data.size() >= 2 && data[0] == 'P' && data[1] == '6') {
+            return decode_ppm(data, name);
+        }
+        logging::error(
+            "The file '" + name + "' is neither a PNG nor a binary PPM"
+        );
+        return rendering::Surface(1, 1);
+    }
+
+    rendering::Surface read_image(const char* file) {
+        logging::info("Reading file '" + std::string(file) + "'");
+        auto stream = std::ifstream(file, std::ios::binary);
+        if(stream.fail()) {
+            logging::error(
+                "The file '" + std::string(file) + "' could not be read"
+            );
+        }
+        auto data = std::vector<uint8_t>(
+            std::istreambuf_iterator<char>(stream),
+            std::istreambuf_iterator<char>()
+        );
+        return decode(data, file);
+    }
+
+}
@@ -0,0 +1,186 @@
+
+#include <druck/multisampling.hpp>
+#include <druck/threading.hpp>
+#include <druck/logging.hpp>
+#include <string>
+
+namespace druck::rendering {
+
+    namespace logging = druck::logging;
+
+
+    // rotated grid patterns (the standard D3D ones), in sixteenths
+    static const Vec<2> positions_1[1] = { Vec<2>(0.0, 0.0) };
+    static const Vec<2> positions_2[2] = {
+        Vec<2>(4.0 / 16, 4.0 / 16), Vec<2>(-4.0 / 16, -4.0 / 16)
+    };
+    static const Vec<2> positions_4[4] = {
+        Vec<2>(-2.0 / 16, -6.0 / 16), Vec<2>(6.0 / 16, -2.0 / 16),
+        Vec<2>(-6.0 / 16, 2.0 / 16), Vec<2>(2.0 / 16, 6.0 / 16)
+    };
+
+    const Vec<2>* multisample_positions(int sample_count) {
+        switch(sample_count) {
+            case 1: return positions_1;
+            case 2: return positions_2;
+            case 4: return positions_4;
+        }
+        logging::error(
+            "The sample count must be 1, 2 or 4 (given was "
+                + std::to_string(sample_count) + ")"
+        );
+        return nullptr;
+    }
+
+    static int verified_sample_count(int sample_count) {
+        multisample_positions(sample_count);
+        return sample_count;
+    }
+
+    MultisampleSurface::MultisampleSurface(
+        int width, int height, int sample_count,
+        PixelFormat format, DepthFormat depth_format
+    ) : sample_count(verified_sample_count(sample_count)),
+        samples(width * sample_count, height, format, depth_format),
+        unresolved({ 0, 0, width, height }) {}
+
+    int MultisampleSurface::width() const {
+        return this->samples.width / this->sample_count;
+    }
+
+    int MultisampleSurface::height() const { return this->samples.height; }
+
+    void MultisampleSurface::resize(int width, int height) {
+        this->samples.resize(width * this->sample_count, height);
+        this->drawn = Rect();
+        this->unresolved = { 0, 0, width, height };
+    }
+
+    void MultisampleSurface::clear() {
+        this->samples.clear();
+        // (the rest of the samples already have the cleared values)
+        this->unresolved = this->unresolved.united(this->drawn);
+        this->drawn = Rect();
+    }
+
+    void MultisampleSurface::verify_draw_state(const DrawState& state) const {
+        if(state.shading_rate != ShadingRate::SHADE_1X1
+            || state.shading_rate_image != nullptr) {
+            logging::error(
+                "Multisample surfaces can't be drawn to with a coarse "
+                    "shading rate"
+            );
+        }
+        if(state.pattern != PixelPattern::ALL_PIXELS) {
+            logging::error(
+                "Multisample surfaces can't be drawn to with a pixel pattern"
+            );
+        }
+    }
+
+    void MultisampleSurface::resolve(Surface& target, bool all) {
+        int width = this->width();
+        int height = this->height();
+        if(target.width != width || target.height != height) {
+            logging::error(
+                "The size of the resolve target ("
+                    + std::to_string(target.width) + "x"
+                    + std::to_string(target.height)
+                    + ") does not match the size of the multisample surface ("
+                    + std::to_string(width) + "x" + std::to_string(height) + ")"
+            );
+        }
+        int count = this->sample_count;
+        Rect area = all ? Rect { 0, 0, width, height } : this->unresolved;
+        area = area.intersected({ 0, 0, width, height });
+        this->unresolved = Rect();
+        if(area.is_empty()) { return; }
+        target.mark_dirty(area);
+        bool srgb = this->samples.srgb;
+        // linear RGBA8 samples can be averaged as integers into linear RGBA8
+        bool direct = this->samples.format == PixelFormat::RGBA8 && !srgb
+            && target.format == PixelFormat::RGBA8 && !target.srgb;
+        threading::parallel_for(area.height, 16, [&](size_t start, size_t end) {
+            std::vector<float> averaged((size_t) area.width * 4);
+            for(size_t row_i = start; row_i < end; row_i += 1) {
+                int y = area.y + (int) row_i;
+                dispatch_pixel_format(this->samples.format, [&]<PixelFormat P>() {
+                    using Stored = typename PixelTraits<P>::Stored;
+                    const Stored* row = (const Stored*) this->samples.color
+                        + (size_t) y * this->samples.pitch
+                        + (size_t) area.x * count;
+                    if constexpr (P == PixelFormat::RGBA8) {
+                        if(direct) {
+                            Color* dest = (Color*) target.color
+                                + (size_t) y * target.pitch + area.x;
+                            for(int x = 0; x < area.width; x += 1) {
+                                const Color* pixel = row + x * count;
+                                int sum[4] = { count / 2, count / 2, count / 2, count / 2 };
+                                for(int s = 0; s < count; s += 1) {
+                                    sum[0] += pixel[s].r;
+                                    sum[1] += pixel[s].g;
+                                    sum[2] += pixel[s].b;
+                                    sum[3] += pixel[s].a;
+                                }
+                                dest[x] = {
+                                    (uint8_t) (sum[0] / count),
+                                    (uint8_t) (sum[1] / count),
+                                    (uint8_t) (sum[2] / count),
+                                    (uint8_t) (sum[3] / count)
+                                };
+                            }
+                            return;
+                        }
+                    }
+                    // average in linear space
+                    float samples[MULTISAMPLE_MAX_SAMPLES * 4];
+                    for(int x = 0; x < area.width; x += 1) {
+                        const Stored* pixel = row + x * count;
+                        if constexpr (P == PixelFormat::RGBA8) {
+                            if(srgb) {
+                                conversion::unpack_srgb8(pixel, samples, count);
+                            } else {
+                                conversion::unpack_rgba8(pixel, samples, count);
+                            }
+                        } else {
+                            for(int s = 0; s < count; s += 1) {
+                                Vec<4> c = PixelTraits<P>::decode(pixel[s]);
+                                float* d = samples + s * 4;
+                                d[0] = c.r(); d[1] = c.g(); d[2] = c.b(); d[3] = c.a();
+                            }
+                        }
+                        float* result = averaged.data() + x * 4;
+                        for(int channel = 0; channel < 4; channel += 1) {
+                            float sum = 0.0f;
+                            for(int s = 0; s < count; s += 1) {
+                                sum += samples[s * 4 + channel];
+                            }
+                            result[channel] = sum / count;
+                        }
+                    }
+                });
+                if(direct) { continue; }
+                dispatch_pixel_format(target.format, [&]<PixelFormat P>() {
+                    using Stored = typename PixelTraits<P>::Stored;
+                    Stored* dest = (Stored*) target.color
+                        + (size_t) y * target.pitch + area.x;
+                    if constexpr (P == PixelFormat::RGBA8) {
+                        if(target.srgb) {
+                            conversion::pack_srgb8(averaged.data(), dest, area.width);
+                        } else {
+                            conversion::pack_rgba8(averaged.data(), dest, area.width);
+                        }
+                        return;
+                    }
+                    for(int x = 0; x < area.width; x += 1) {
+                        const float* c = averaged.data() + x * 4;
+                        dest[x] = PixelTraits<P>::encode(
+                            Vec<4>(c[0], c[1], c[2], c[3])
+                        );
+                    }
+                });
+            }
+        });
+    }
+
+}
@@ -0,0 +1,375 @@
+
+#include <druck/occlusion.hpp>
+#include <druck/logging.hpp>
+#include <cmath>
+#include <string>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace druck::rendering {
+
+    // The corners of the faces of a box (corner i is at the maximum of the
+    // box on the axes of its set bits, 1 for x, 2 for y and 4 for z),
+    // counter-clockwise as seen from outside the box
+    static const int box_faces[6][4] = {
+        { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 },
+        { 2, 6, 7, 3 }, { 0, 2, 3, 1 }, { 4, 5, 7, 6 }
+    };
+
+    // Calls 'pass()' for every pixel of the faces of the box facing the
+    // camera that passes the depth test, until it returns false.
+    // Returns false without rasterizing anything if the box reaches behind
+    // the camera or in front of the near plane.
+    template<DepthFormat D, typename F>
+    static bool rasterize_box(
+        const Surface& surface, const Box& box,
+        const Mat<4>& model_view_projection, F&& pass
+    ) {
+        using Depth = DepthTraits<D>;
+        int width = surface.width;
+        int height = surface.height;
+        Mat<3> to_pixel_space = ndc_to_pixel_space(width, height);
+        // pixel positions and NDC depths of the corners
+        Vec<3> corners[8];
+        for(int i = 0; i < 8; i += 1) {
+            Vec<4> corner = Vec<4>(
+                (i & 1) ? box.max.x() : box.min.x(),
+                (i & 2) ? box.max.y() : box.min.y(),
+                (i & 4) ? box.max.z() : box.min.z(),
+                1.0
+            );
+            Vec<4> clip = model_view_projection * corner;
+            if(clip.w() <= 0.0 || clip.z() < -clip.w()) { return false; }
+            corners[i] = to_pixel_space * (clip.swizzle<3>("xyz") / clip.w());
+        }
+        // returns false if 'pass' asked to stop
+        auto triangle = [&](Vec<3>& a, Vec<3>& b, Vec<3>& c) {
+            Vec<2> a_pixel = a.swizzle<2>("xy");
+            Vec<2> b_pixel = b.swizzle<2>("xy");
+            Vec<2> c_pixel = c.swizzle<2>("xy");
+            double area_signed = signed_triangle_area(a_pixel, b_pixel, c_pixel);
+            // faces turned towards the camera are clockwise in pixel space
+            // (where y points down)
+            if(area_signed >= 0.0) { return true; }
+            Rect area = Rect {
+                (int) std::floor(std::min({ a.x(), b.x(), c.x() })),
+                (int) std::floor(std::min({ a.y(), b.y(), c.y() })),
+                0, 0
+            };
+            area.width = (int) std::ceil(std::max({ a.x(), b.x(), c.x() }))
+                - area.x + 1;
+            area.height = (int) std::ceil(std::max({ a.y(), b.y(), c.y() }))
+                - area.y + 1;
+            area = area.intersected({ 0, 0, width, height });
+            // barycentric coordinates as 'base + dx * x + dy * y', with
+            // pixels exactly on an edge belonging to only one of the two
+            // triangles sharing it (as in 'MultisampleSurface')
+            double base[3];
+            double dx[3];
+            double dy[3];
+            bool owns_edge[3];
+            Vec<2> edges[3][2] = {
+                { b_pixel, c_pixel }, { c_pixel, a_pixel }, { a_pixel, b_pixel }
+            };
+            for(int i = 0; i < 3; i += 1) {
+                const Vec<2>& p = edges[i][0];
+                const Vec<2>& q = edges[i][1];
+                base[i] = 0.5 * (p.x() * q.y() - q.x() * p.y()) / area_signed;
+                dx[i] = 0.5 * (p.y() - q.y()) / area_signed;
+                dy[i] = 0.5 * (q.x() - p.x()) / area_signed;
+                owns_edge[i] = dx[i] > 0.0 || (dx[i] == 0.0 && dy[i] > 0.0);
+            }
+            double z[3] = { a.z(), b.z(), c.z() };
+            for(int y = area.y; y < area.y + area.height; y += 1) {
+                const typename Depth::Stored* depth_row = surface.depth == nullptr
+                    ? nullptr
+                    : (const typename Depth::Stored*) surface.depth
+                        + (size_t) y * surface.pitch;
+                for(int x = area.x; x < area.x + area.width; x += 1) {
+                    double bc[3];
+                    bool covered = true;
+                    for(int i = 0; i < 3; i += 1) {
+                        bc[i] = base[i] + dx[i] * x + dy[i] * y;
+                        covered &= bc[i] > 0.0 || (bc[i] == 0.0 && owns_edge[i]);
+                    }
+                    if(!covered) { continue; }
+                    double depth = (bc[0] * z[0] + bc[1] * z[1] + bc[2] * z[2])
+                        * 0.5 + 0.5;
+                    if(depth > 1.0) { continue; }
+                    bool passes = depth_row == nullptr
+                        || Depth::passes(Depth::encode(depth), depth_row[x]);
+                    if(passes && !pass()) { return false; }
+                }
+            }
+            return true;
+        };
+        for(const int* face: box_faces) {
+            Vec<3>& a = corners[face[0]];
+            Vec<3>& b = corners[face[1]];
+            Vec<3>& c = corners[face[2]];
+            Vec<3>& d = corners[face[3]];
+            if(!triangle(a, b, c) || !triangle(a, c, d)) { break; }
+        }
+        return true;
+    }
+
+    size_t count_visible_pixels(
+        const Surface& surface, const Box& box,
+        const Mat<4>& model_view_projection
+    ) {
+        size_t count = 0;
+        bool in_front = true;
+        dispatch_depth_format(surface.depth_format, [&]<DepthFormat D>() {
+            in_front = rasterize_box<D>(
+                surface, box, model_view_projection,
+                [&]() { count += 1; return true; }
+            );
+        });
+        if(!in_front) { return (size_t) surface.width * surface.height; }
+        return count;
+    }
+
+    bool is_visible(
+        const Surface& surface, const Box& box,
+        const Mat<4>& model_view_projection
+    ) {
+        bool visible = false;
+        bool in_front = true;
+        dispatch_depth_format(surface.depth_format, [&]<DepthFormat D>() {
+            in_front = rasterize_box<D>(
+                surface, box, model_view_projection,
+                [&]() { visible = true; return false; }
+            );
+        });
+        return visible || !in_front;
+    }
+
+
+    void OcclusionQueries::test(
+        size_t object, const Surface& surface, const Box& box,
+        const Mat<4>& model_view_projection
+    ) {
+        if(object >= this->visible.size()) {
+            this->visible.resize(object + 1, true);
+        }
+        this->visible[object] = is_visible(surface, box, model_view_projection);
+    }
+
+    bool OcclusionQueries::was_visible(size_t object) const {
+        return object >= this->visible.size() || this->visible[object];
+    }
+
+    void OcclusionQueries::reset() { this->visible.clear(); }
+
+
+
+    OcclusionBuffer::OcclusionBuffer(int width, int height) {
+        if(width <= 0 || height <= 0) {
+            druck::logging::error(
+                "The size of an occlusion buffer must be positive (given was "
+                    + std::to_string(width) + "x" + std::to_string(height) + ")"
+            );
+        }
+        this->width = width;
+        this->height = height;
+        this->pitch = (width + 3) & ~3;
+        this->depth.resize((size_t) this->pitch * height);
+        this->clear();
+    }
+
+    void OcclusionBuffer::clear() {
+        std::fill(this->depth.begin(), this->depth.end(), 1.0f);
+    }
+
+    Vec<3> OcclusionBuffer::to_buffer_space(const Vec<4>& clip) const {
+        double x = clip.x() / clip.w();
+        double y = clip.y() / clip.w();
+        double z = clip.z() / clip.w();
+        // (the same as 'ndc_to_pixel_space')
+        double half_width = this->width / 2;
+        double half_height = this->height / 2;
+        return Vec<3>(
+            half_width * (x + z),
+            this->height * z - half_height * (y + z),
+            z * 0.5 + 0.5
+        );
+    }
+
+    void OcclusionBuffer::draw_triangles(
+        const std::vector<std::tuple<uint32_t, uint32_t, uint32_t>>& elements
+    ) {
+        const std::vector<Vec<4>>& clip = this->clip_positions;
+        auto in_front = [](const Vec<4>& p) {
+            return p.w() > 0.0 && p.z() >= -p.w();
+        };
+        for(const auto& [a, b, c]: elements) {
+            if(!in_front(clip[a]) || !in_front(clip[b]) || !in_front(clip[c])) {
+                continue;
+            }
+            this->draw_triangle(
+                this->to_buffer_space(clip[a]),
+                this->to_buffer_space(clip[b]),
+                this->to_buffer_space(clip[c])
+            );
+        }
+    }
+
+    void OcclusionBuffer::draw_triangle(
+        const Vec<3>& a, const Vec<3>& b, const Vec<3>& c
+    ) {
+        double area_doubled = (b.x() - a.x()) * (c.y() - a.y())
+            - (c.x() - a.x()) * (b.y() - a.y());
+        if(area_doubled == 0.0) { return; }
+        // pixels (x, y) whose centers lie inside the triangle
+        int start_x = std::max(
+            (int) std::floor(std::min({ a.x(), b.x(), c.x() }) - 0.5), 0
+        );
+        int end_x = std::min(
+            (int) std::ceil(std::max({ a.x(), b.x(), c.x() }) - 0.5), this->width - 1
+        );
+        int start_y = std::max(
+            (int) std::floor(std::min({ a.y(), b.y(), c.y() }) - 0.5), 0
+        );
+        int end_y = std::min(
+            (int) std::ceil(std::max({ a.y(), b.y(), c.y() }) - 0.5), this->height - 1
+        );
+        if(start_x > end_x || start_y > end_y) { return; }
+        // The edge functions ('e_x * x + e_y * y + e_c', positive inside
+        // for either winding) and the depth plane, at pixel centers
+        float e_x[3];
+        float e_y[3];
+        float e_c[3];
+        const Vec<3>* vertices[3] = { &a, &b, &c };
+        double sign = area_doubled > 0.0 ? 1.0 : -1.0;
+        for(int i = 0; i < 3; i += 1) {
+            const Vec<3>& p = *vertices[(i + 1) % 3];
+            const Vec<3>& q = *vertices[(i + 2) % 3];
+            double dx = (q.x() - p.x()) * sign;
+            double dy = (q.y() - p.y()) * sign;
+            e_x[i] = (float) -dy;
+            e_y[i] = (float) dx;
+            e_c[i] = (float) (dy * (p.x() - 0.5) - dx * (p.y() - 0.5));
+        }
+        double z_x = ((b.z() - a.z()) * (c.y() - a.y())
+            - (c.z() - a.z()) * (b.y() - a.y())) / area_doubled;
+        double z_y = ((c.z() - a.z()) * (b.x() - a.x())
+            - (b.z() - a.z()) * (c.x() - a.x())) / area_doubled;
+        float z_c = (float) (a.z() - z_x * (a.x() - 0.5) - z_y * (a.y() - 0.5));
+        // 4 pixels at a time, starting at a multiple of 4 (rows are padded
+        // to a multiple of 4 pixels, so the padding may be written to)
+        start_x &= ~3;
+    #ifdef __SSE2__
+        const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 far_plane = _mm_set1_ps(1.0f);
+        __m128 step_x[3];
+        for(int i = 0; i < 3; i += 1) {
+            step_x[i] = _mm_set1_ps(e_x[i] * 4.0f);
+        }
+        __m128 z_step = _mm_set1_ps((float) z_x * 4.0f);
+        for(int y = start_y; y <= end_y; y += 1) {
+            float* row = this->depth.data() + (size_t) y * this->pitch;
+            __m128 xs = _mm_add_ps(_mm_set1_ps((float) start_x), offsets);
+            __m128 edges[3];
+            for(int i = 0; i < 3; i += 1) {
+                edges[i] = _mm_add_ps(
+                    _mm_mul_ps(_mm_set1_ps(e_x[i]), xs),
+                    _mm_set1_ps(e_y[i] * y + e_c[i])
+                );
+            }
+            __m128 z = _mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps((float) z_x), xs),
+                _mm_set1_ps((float) z_y * y + z_c)
+            );
+            for(int x = start_x; x <= end_x; x += 4) {
+                // inside all edges (the sign bits are clear) and in front
+                // of the far plane
+                __m128 outside = _mm_or_ps(_mm_or_ps(edges[0], edges[1]), edges[2]);
+                __m128 covered = _mm_andnot_ps(
+                    _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(outside), 31)),
+                    _mm_cmple_ps(z, far_plane)
+                );
+                if(_mm_movemask_ps(covered) != 0) {
+                    __m128 stored = _mm_loadu_ps(row + x);
+                    __m128 closer = _mm_min_ps(stored, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(
+                        _mm_and_ps(covered, closer),
+                        _mm_andnot_ps(covered, stored)
+                    ));
+                }
+                for(int i = 0; i < 3; i += 1) {
+                    edges[i] = _mm_add_ps(edges[i], step_x[i]);
+                }
+                z = _mm_add_ps(z, z_step);
+            }
+        }
+    #else
+        for(int y = start_y; y <= end_y; y += 1) {
+            float* row = this->depth.data() + (size_t) y * this->pitch;
+            for(int x = start_x; x <= end_x; x += 1) {
+                bool covered = true;
+                for(int i = 0; i < 3; i += 1) {
+                    covered &= e_x[i] * x + e_y[i] * y + e_c[i] >= 0.0f;
+                }
+                float z = (float) z_x * x + (float) z_y * y + z_c;
+                if(covered && z <= 1.0f) { row[x] = std::min(row[x], z); }
+            }
+        }
+    #endif
+    }
+
+    bool OcclusionBuffer::is_visible(
+        const Box& box, const Mat<4>& model_view_projection
+    ) const {
+        // the rectangle covered by the box and its closest depth
+        double min_x = INFINITY;
+        double min_y = INFINITY;
+        double max_x = -INFINITY;
+        double max_y = -INFINITY;
+        double closest = INFINITY;
+        for(int i = 0; i < 8; i += 1) {
+            Vec<4> corner = Vec<4>(
+                (i & 1) ? box.max.x() : box.min.x(),
+                (i & 2) ? box.max.y() : box.min.y(),
+                (i & 4) ? box.max.z() : box.min.z(),
+                1.0
+            );
+            Vec<4> clip = model_view_projection * corner;
+            if(clip.w() <= 0.0 || clip.z() < -clip.w()) { return true; }
+            Vec<3> p = this->to_buffer_space(clip);
+            min_x = std::min(min_x, p.x());
+            min_y = std::min(min_y, p.y());
+            max_x = std::max(max_x, p.x());
+            max_y = std::max(max_y, p.y());
+            closest = std::min(closest, p.z());
+        }
+        if(closest > 1.0) { return false; }
+        // all pixels the box may overlap (not just the ones with their
+        // centers inside)
+        int start_x = std::max((int) std::floor(min_x), 0);
+        int end_x = std::min((int) std::floor(max_x), this->width - 1);
+        int start_y = std::max((int) std::floor(min_y), 0);
+        int end_y = std::min((int) std::floor(max_y), this->height - 1);
+        if(start_x > end_x || start_y > end_y) { return false; }
+        float box_depth = (float) closest;
+        for(int y = start_y; y <= end_y; y += 1) {
+            const float* row = this->depth.data() + (size_t) y * this->pitch;
+            int x = start_x;
+        #ifdef __SSE2__
+            __m128 box_depths = _mm_set1_ps(box_depth);
+            for(; x + 3 <= end_x; x += 4) {
+                __m128 stored = _mm_loadu_ps(row + x);
+                if(_mm_movemask_ps(_mm_cmplt_ps(box_depths, stored)) != 0) {
+                    return true;
+                }
+            }
+        #endif
+            for(; x <= end_x; x += 1) {
+                if(box_depth < row[x]) { return true; }
+            }
+        }
+        return false;
+    }
+
+}
@@ -0,0 +1,182 @@
+
+#include <druck/optimization.hpp>
+#include <druck/logging.hpp>
+#include <algorithm>
+#include <string>
+
+namespace druck::rendering {
+
+    static void verify_indices(
+        const std::vector<std::tuple<uint32_t, uint32_t, uint32_t>>& elements,
+        size_t vertex_count
+    ) {
+        for(const auto& [a, b, c]: elements) {
+            if(a < vertex_count && b < vertex_count && c < vertex_count) {
+                continue;
+            }
+            logging::error(
+                "Mesh element refers to vertex "
+                    + std::to_string(std::max({ a, b, c }))
+                    + ", but the mesh only has "
+                    + std::to_string(vertex_count) + " vertices"
+            );
+        }
+    }
+
+    // The triangles using each vertex (those of vertex i are at
+    // 'triangles[starts[i]]' up to 'triangles[starts[i + 1]]')
+    struct Adjacency {
+        std::vector<uint32_t> starts;
+        std::vector<uint32_t> triangles;
+    };
+
+    static Adjacency vertex_triangles(
+        const std::vector<std::tuple<uint32_t, uint32_t, uint32_t>>& elements,
+        size_t vertex_count
+    ) {
+        Adjacency adjacency;
+        adjacency.starts.assign(vertex_count + 1, 0);
+        for(const auto& [a, b, c]: elements) {
+            adjacency.starts[a + 1] += 1;
+            adjacency.starts[b + 1] += 1;
+            adjacency.starts[c + 1] += 1;
+        }
+        for(size_t vert_i = 0; vert_i < vertex_count; vert_i += 1) {
+            adjacency.starts[vert_i + 1] += adjacency.starts[vert_i];
+        }
+        adjacency.triangles.resize(elements.size() * 3);
+        std::vector<uint32_t> next(
+            adjacency.starts.begin(), adjacency.starts.end() - 1
+        );
+        for(size_t elem_i = 0; elem_i < elements.size(); elem_i += 1) {
+            auto [a, b, c] = elements[elem_i];
+            adjacency.triangles[next[a]++] = elem_i;
+            adjacency.triangles[next[b]++] = elem_i;
+            adjacency.triangles[next[c]++] = elem_i;
+        }
+        return adjacency;
+    }
+
+    void optimize_vertex_cache(
+        std::vector<std::tuple<uint32_t, uint32_t, uint32_t>>& elements,
+        size_t vertex_count, size_t cache_size
+    ) {
+        if(elements.size() == 0) { return; }
+        verify_indices(elements, vertex_count);
+        Adjacency adjacency = vertex_triangles(elements, vertex_count);
+        // the number of triangles using each vertex that are not placed yet
+        std::vector<uint32_t> live(vertex_count);
+        for(size_t vert_i = 0; vert_i < vertex_count; vert_i += 1) {
+            live[vert_i] = adjacency.starts[vert_i + 1]
+                - adjacency.starts[vert_i];
+        }
+        // when each vertex has last entered the modelled cache (a vertex
+        // is in it if less than 'cache_size' vertices have entered since)
+        std::vector<size_t> cache_time(vertex_count, 0);
+        size_t time = cache_size + 1;
+        std::vector<bool> placed(elements.size(), false);
+        std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> result;
+        result.reserve(elements.size());
+        // vertices of recently placed triangles, to continue from when the
+        // current vertex has no good successor
+        std::vector<uint32_t> dead_ends;
+        std::vector<uint32_t> candidates;
+        size_t cursor = 0;
+        int64_t fan = std::get<0>(elements[0]);
+        while(fan >= 0) {
+            // place all remaining triangles around the current vertex
+            candidates.clear();
+            uint32_t adj_end = adjacency.starts[fan + 1];
+            for(uint32_t adj_i = adjacency.starts[fan]; adj_i < adj_end; adj_i += 1) {
+                uint32_t elem_i = adjacency.triangles[adj_i];
+                if(placed[elem_i]) { continue; }
+                placed[elem_i] = true;
+                result.push_back(elements[elem_i]);
+                auto [a, b, c] = elements[elem_i];
+                for(uint32_t vertex: { a, b, c }) {
+                    dead_ends.push_back(vertex);
+                    candidates.push_back(vertex);
+                    live[vertex] -= 1;
+                    if(time - cache_time[vertex] > cache_size) {
+                        cache_time[vertex] = time;
+                        time += 1;
+                    }
+                }
+            }
+            // continue with the candidate that will still be in the cache
+            // after placing its remaining triangles and has been in it the
+            // longest (since it is the next to be evicted)
+            fan = -1;
+            size_t best_priority = 0;
+            for(uint32_t vertex: candidates) {
+                if(live[vertex] == 0) { continue; }
+                size_t priority = 1;
+                size_t age = time - cache_time[vertex];
+                if(age + 2 * live[vertex] <= cache_size) {
+                    priority += age;
+                }
+                if(priority > best_priority) {
+                    best_priority = priority;
+                    fan = vertex;
+                }
+            }
+            if(fan >= 0) { continue; }
+            // none of them is left, try the recently used vertices and then
+            // the remaining vertices in order
+            while(fan < 0 && dead_ends.size() > 0) {
+                uint32_t vertex = dead_ends.back();
+                dead_ends.pop_back();
+                if(live[vertex] > 0) { fan = vertex; }
+            }
+            while(fan < 0 && cursor < vertex_count) {
+                if(live[cursor] > 0) { fan = cursor; }
+                cursor += 1;
+            }
+        }
+        elements = std::move(result);
+    }
+
+    size_t remap_vertex_fetch(
+        std::vector<std::tuple<uint32_t, uint32_t, uint32_t>>& elements,
+        size_t vertex_count, std::vector<uint32_t>& remap
+    ) {
+        verify_indices(elements, vertex_count);
+        remap.assign(vertex_count, UINT32_MAX);
+        uint32_t used = 0;
+        auto map = [&](uint32_t& vertex) {
+            if(remap[vertex] == UINT32_MAX) {
+                remap[vertex] = used;
+                used += 1;
+            }
+            vertex = remap[vertex];
+        };
+        for(auto& [a, b, c]: elements) {
+            map(a);
+            map(b);
+            map(c);
+        }
+        return used;
+    }
+
+    double average_cache_miss_ratio(
+        const std::vector<std::tuple<uint32_t, uint32_t, uint32_t>>& elements,
+        size_t vertex_count
+    ) {
+        if(elements.size() == 0) { return 0.0; }
+        verify_indices(elements, vertex_count);
+        // same mapping as 'VertexCache'
+        size_t size = std::min((size_t) VERTEX_CACHE_SIZE, vertex_count);
+        std::vector<uint32_t> cached(size, UINT32_MAX);
+        size_t misses = 0;
+        for(const auto& [a, b, c]: elements) {
+            for(uint32_t vertex: { a, b, c }) {
+                uint32_t& entry = cached[vertex % size];
+                if(entry == vertex) { continue; }
+                entry = vertex;
+                misses += 1;
+            }
+        }
+        return (double) misses / elements.size();
+    }
+
+}
@@ -0,0 +1,722 @@
+
+#include <druck/postprocess.hpp>
+#include <druck/threading.hpp>
+#include <druck/logging.hpp>
+#include <druck/conversion.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <string>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace druck::postprocess {
+
+    namespace logging = druck::logging;
+    namespace conversion = druck::conversion;
+    using rendering::Color;
+    using rendering::Surface;
+
+
+    // the distances between the positions checked when searching for the
+    // ends of an edge (in pixels, growing for long edges)
+    static const int FXAA_SEARCH_STEPS[] = { 1, 1, 1, 1, 1, 2, 2, 2, 2, 4, 8 };
+
+    Fxaa::Fxaa(
+        double edge_threshold, double edge_threshold_min, double subpixel
+    ) {
+        this->edge_threshold = (uint16_t) std::clamp(
+            edge_threshold * 65536.0, 0.0, 65535.0
+        );
+        this->edge_threshold_min = (uint8_t) std::clamp(
+            std::round(edge_threshold_min * 255.0), 0.0, 255.0
+        );
+        this->subpixel = (float) std::clamp(subpixel, 0.0, 1.0);
+    }
+
+    static uint8_t luma_of(Color c) {
+        return (uint8_t) ((c.r * 77 + c.g * 150 + c.b * 29 + 128) >> 8);
+    }
+
+    Color Fxaa::filter_pixel(
+        const Surface& src, int x, int y, int contrast,
+        const uint8_t* above, const uint8_t* center, const uint8_t* below
+    ) const {
+        float m = center[x];
+        float n = above[x];
+        float s = below[x];
+        float w = center[x - 1];
+        float e = center[x + 1];
+        float nw = above[x - 1];
+        float ne = above[x + 1];
+        float sw = below[x - 1];
+        float se = below[x + 1];
+        // a horizontal edge has the largest differences between rows
+        float edge_horizontal = std::fabs(nw + sw - 2 * w)
+            + std::fabs(n + s - 2 * m) * 2
+            + std::fabs(ne + se - 2 * e);
+        float edge_vertical = std::fabs(nw + ne - 2 * n)
+            + std::fabs(w + e - 2 * m) * 2
+            + std::fabs(sw + se - 2 * s);
+        bool horizontal = edge_horizontal >= edge_vertical;
+        // the neighbor on the other side of the edge is the one with the
+        // larger difference
+        float before = horizontal ? n : w;
+        float after = horizontal ? s : e;
+        float gradient_before = std::fabs(before - m);
+        float gradient_after = std::fabs(after - m);
+        int step = gradient_before >= gradient_after ? -1 : 1;
+        float edge_luma = (m + (step < 0 ? before : after)) * 0.5f;
+        float gradient_scaled
+            = std::max(gradient_before, gradient_after) * 0.25f;
+        // search along the edge (halfway between this pixel and the
+        // neighbor) for both of its ends, in the rows converted to luma
+        // for horizontal edges and in the pixels themselves for vertical
+        // ones
+        int position = horizontal ? x : y;
+        int size = horizontal ? src.width : src.height;
+        const uint8_t* other = step < 0 ? above : below;
+        const Color* column = (const Color*) src.color + x;
+        int other_offset = std::clamp(x + step, 0, src.width - 1) - x;
+        auto luma_at = [&](int distance) {
+            if(horizontal) {
+                return (center[x + distance] + other[x + distance]) * 0.5f
+                    - edge_luma;
+            }
+            const Color* pixel = column + (ptrdiff_t) (y + distance) * src.pitch;
+            return (luma_of(pixel[0]) + luma_of(pixel[other_offset])) * 0.5f
+                - edge_luma;
+        };
+        int distance_before = 0;
+        int distance_after = 0;
+        float end_before = 0.0f;
+        float end_after = 0.0f;
+        bool done_before = false;
+        bool done_after = false;
+        for(int search_step: FXAA_SEARCH_STEPS) {
+            if(!done_before) {
+                distance_before = std::min(
+                    distance_before + search_step, position
+                );
+                end_before = luma_at(-distance_before);
+                done_before = std::fabs(end_before) >= gradient_scaled
+                    || distance_before == position;
+            }
+            if(!done_after) {
+                distance_after = std::min(
+                    distance_after + search_step, size - 1 - position
+                );
+                end_after = luma_at(distance_after);
+                done_after = std::fabs(end_after) >= gradient_scaled
+                    || distance_after == size - 1 - position;
+            }
+            if(done_before && done_after) { break; }
+        }
+        // pixels closer to the end where the edge crosses this pixel's
+        // luma get blended more
+        bool closer_before = distance_before < distance_after;
+        float distance = (float) std::min(distance_before, distance_after);
+        float edge_length = (float) (distance_before + distance_after);
+        float offset = 0.0f;
+        if(edge_length > 0.0f) {
+            float end = closer_before ? end_before : end_after;
+            if((end < 0.0f) != (m < edge_luma)) {
+                offset = 0.5f - distance / edge_length;
+            }
+        }
+        // single pixel features are blended by their contrast to the
+        // average of the neighborhood
+        float average = (2.0f * (n + s + w + e) + nw + ne + sw + se) / 12.0f;
+        float subpixel = std::clamp(std::fabs(average - m) / contrast, 0.0f, 1.0f);
+        subpixel = (-2.0f * subpixel + 3.0f) * subpixel * subpixel;
+        offset = std::max(offset, subpixel * subpixel * this->subpixel);
+        // blend with the neighbor across the edge
+        int other_x = horizontal ? x : std::clamp(x + step, 0, src.width - 1);
+        int other_y = horizontal ? std::clamp(y + step, 0, src.height - 1) : y;
+        const Color* pixels = (const Color*) src.color;
+        Color a = pixels[(size_t) y * src.pitch + x];
+        Color b = pixels[(size_t) other_y * src.pitch + other_x];
+        int t = (int) (offset * 256.0f + 0.5f);
+        auto mix = [&](uint8_t from, uint8_t to) {
+            return (uint8_t) (from + (((to - from) * t + 128) >> 8));
+        };
+        return { mix(a.r, b.r), mix(a.g, b.g), mix(a.b, b.b), mix(a.a, b.a) };
+    }
+
+    int Fxaa::edge_contrast(int m, int n, int s, int w, int e) const {
+        int highest = std::max({ m, n, s, w, e });
+        int lowest = std::min({ m, n, s, w, e });
+        int threshold = std::max(
+            (int) this->edge_threshold_min,
+            (highest * this->edge_threshold) >> 16
+        );
+        int contrast = highest - lowest;
+        return contrast < threshold || contrast == 0 ? 0 : contrast;
+    }
+
+    void Fxaa::filter_rows(
+        const Surface& src, Surface& dest, int start_y, int end_y
+    ) const {
+        // the luma of the rows above, at and below the current one (with
+        // the edge pixels repeated into one pixel of padding on each side),
+        // so that every row is only converted once
+        size_t stride = (size_t) src.width + 2;
+        std::vector<uint8_t> lines(stride * 3);
+        auto line = [&](int y) {
+            return lines.data() + (size_t) ((y + 3) % 3) * stride + 1;
+        };
+        auto src_row = [&](int y) {
+            y = std::clamp(y, 0, src.height - 1);
+            return (const Color*) src.color + (size_t) y * src.pitch;
+        };
+        for(int y: { start_y - 1, start_y }) {
+            const Color* row = src_row(y);
+            uint8_t* luma = line(y);
+            for(int x = -1; x <= src.width; x += 1) {
+                luma[x] = luma_of(row[std::clamp(x, 0, src.width - 1)]);
+            }
+        }
+        for(int y = start_y; y < end_y; y += 1) {
+            const Color* row = src_row(y);
+            const Color* below = src_row(y + 1);
+            Color* dest_row = (Color*) dest.color + (size_t) y * dest.pitch;
+            const uint8_t* n = line(y - 1);
+            const uint8_t* m = line(y);
+            uint8_t* s = line(y + 1);
+            auto filter = [&](int x, int contrast) {
+                dest_row[x] = this->filter_pixel(src, x, y, contrast, n, m, s);
+            };
+            s[-1] = luma_of(below[0]);
+            int x = 0;
+            int tested = 0;
+#ifdef __SSE2__
+            // converts the row below to luma while finding the edges among
+            // 16 pixels of this row at once (most pixels are not on one)
+            // and copying them to 'dest', in a single pass.
+            // The edges are found two blocks behind the conversion, since
+            // the search along horizontal edges reads up to 25 pixels ahead.
+            const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+            const __m128i rb_weights = _mm_setr_epi16(77, 29, 77, 29, 77, 29, 77, 29);
+            const __m128i g_weights = _mm_setr_epi16(150, 0, 150, 0, 150, 0, 150, 0);
+            const __m128i rounding = _mm_set1_epi32(128);
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i threshold_factor = _mm_set1_epi16((short) this->edge_threshold);
+            const __m128i threshold_min = _mm_set1_epi16(this->edge_threshold_min);
+            // the luma of 4 pixels as 32-bit values
+            auto luma_epi32 = [&](const Color* pixels) {
+                __m128i p = _mm_loadu_si128((const __m128i*) pixels);
+                // (r, b) and (g, a) of each pixel as 16-bit values
+                __m128i rb = _mm_and_si128(p, low_bytes);
+                __m128i ga = _mm_srli_epi16(p, 8);
+                __m128i sums = _mm_add_epi32(
+                    _mm_madd_epi16(rb, rb_weights), _mm_madd_epi16(ga, g_weights)
+                );
+                return _mm_srli_epi32(_mm_add_epi32(sums, rounding), 8);
+            };
+            auto skipped_epi16 = [&](__m128i highest, __m128i contrast) {
+                __m128i threshold = _mm_max_epi16(
+                    _mm_mulhi_epu16(highest, threshold_factor), threshold_min
+                );
+                return _mm_cmpgt_epi16(threshold, contrast);
+            };
+            auto filter_block = [&](int x) {
+                for(int i = 0; i < 4; i += 1) {
+                    _mm_storeu_si128(
+                        (__m128i*) (dest_row + x) + i,
+                        _mm_loadu_si128((const __m128i*) (row + x) + i)
+                    );
+                }
+                __m128i center = _mm_loadu_si128((const __m128i*) (m + x));
+                __m128i neighbors[4] = {
+                    _mm_loadu_si128((const __m128i*) (n + x)),
+                    _mm_loadu_si128((const __m128i*) (s + x)),
+                    _mm_loadu_si128((const __m128i*) (m + x - 1)),
+                    _mm_loadu_si128((const __m128i*) (m + x + 1))
+                };
+                __m128i highest = center;
+                __m128i lowest = center;
+                for(__m128i neighbor: neighbors) {
+                    highest = _mm_max_epu8(highest, neighbor);
+                    lowest = _mm_min_epu8(lowest, neighbor);
+                }
+                __m128i contrast = _mm_subs_epu8(highest, lowest);
+                __m128i skipped = _mm_packs_epi16(
+                    skipped_epi16(
+                        _mm_unpacklo_epi8(highest, zero),
+                        _mm_unpacklo_epi8(contrast, zero)
+                    ),
+                    skipped_epi16(
+                        _mm_unpackhi_epi8(highest, zero),
+                        _mm_unpackhi_epi8(contrast, zero)
+                    )
+                );
+                skipped = _mm_or_si128(skipped, _mm_cmpeq_epi8(contrast, zero));
+                int edges = ~_mm_movemask_epi8(skipped) & 0xFFFF;
+                if(edges == 0) { return; }
+                alignas(16) uint8_t contrasts[16];
+                _mm_store_si128((__m128i*) contrasts, contrast);
+                while(edges != 0) {
+                    int i = __builtin_ctz(edges);
+                    edges &= edges - 1;
+                    filter(x + i, contrasts[i]);
+                }
+            };
+            for(; x + 16 <= src.width; x += 16) {
+                _mm_storeu_si128(
+                    (__m128i*) (s + x),
+                    _mm_packus_epi16(
+                        _mm_packs_epi32(luma_epi32(below + x), luma_epi32(below + x + 4)),
+                        _mm_packs_epi32(luma_epi32(below + x + 8), luma_epi32(below + x + 12))
+                    )
+                );
+                if(x >= 32) {
+                    filter_block(x - 32);
+                    tested = x - 16;
+                }
+            }
+#endif
+            for(; x < src.width; x += 1) {
+                s[x] = luma_of(below[x]);
+            }
+            s[src.width] = s[src.width - 1];
+#ifdef __SSE2__
+            for(; tested + 16 <= src.width; tested += 16) {
+                filter_block(tested);
+            }
+#endif
+            for(; tested < src.width; tested += 1) {
+                dest_row[tested] = row[tested];
+                int contrast = this->edge_contrast(
+                    m[tested], n[tested], s[tested],
+                    m[tested - 1], m[tested + 1]
+                );
+                if(contrast != 0) { filter(tested, contrast); }
+            }
+        }
+    }
+
+    void Fxaa::apply(const Surface& src, Surface& dest) {
+        if(src.format != rendering::PixelFormat::RGBA8
+            || dest.format != rendering::PixelFormat::RGBA8) {
+            logging::error("FXAA can only be applied to RGBA8 surfaces");
+        }
+        if(src.width != dest.width || src.height != dest.height) {
+            logging::error(
+                "The size of the FXAA source (" + std::to_string(src.width)
+                    + "x" + std::to_string(src.height)
+                    + ") does not match the size of the destination ("
+                    + std::to_string(dest.width) + "x"
+                    + std::to_string(dest.height) + ")"
+            );
+        }
+        if(src.color == dest.color) {
+            logging::error("FXAA can't be applied in place");
+        }
+        dest.mark_dirty({ 0, 0, dest.width, dest.height });
+        threading::parallel_for(src.height, 32, [&](size_t start, size_t end) {
+            this->filter_rows(src, dest, (int) start, (int) end);
+        });
+    }
+
+
+
+    // the weight of each channel in the luminance of linear colors (BT.709)
+    static const float LUMINANCE_WEIGHTS[3] = { 0.2126f, 0.7152f, 0.0722f };
+
+    // Returns 'then' applied after 'first' (see 'Chain::PixelOp::matrix')
+    static void compose_matrices(
+        const float* first, const float* then, float* result
+    ) {
+        float composed[20];
+        for(int col = 0; col < 5; col += 1) {
+            for(int row = 0; row < 4; row += 1) {
+                float value = col == 4 ? then[16 + row] : 0.0f;
+                for(int k = 0; k < 4; k += 1) {
+                    value += then[k * 4 + row] * first[col * 4 + k];
+                }
+                composed[col * 4 + row] = value;
+            }
+        }
+        std::copy(composed, composed + 20, result);
+    }
+
+    static void identity_matrix(float* matrix) {
+        std::fill(matrix, matrix + 20, 0.0f);
+        for(int i = 0; i < 4; i += 1) { matrix[i * 4 + i] = 1.0f; }
+    }
+
+#ifndef __SSE2__
+    static float reinhard(float c) {
+        c = std::max(c, 0.0f);
+        return c / (1.0f + c);
+    }
+
+    static float aces(float c) {
+        c = std::max(c, 0.0f);
+        return std::min(
+            (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f), 1.0f
+        );
+    }
+#endif
+
+    // Applies all given effects to each pixel (while it is in registers)
+    template<typename Op>
+    static void apply_ops(const std::vector<Op>& ops, float* pixels, size_t count) {
+        if(ops.size() == 0) { return; }
+#ifdef __SSE2__
+        const __m128 rgb = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for(size_t i = 0; i < count; i += 1) {
+            __m128 p = _mm_loadu_ps(pixels + i * 4);
+            for(const Op& op: ops) {
+                if(op.kind == Op::MATRIX) {
+                    const float* m = op.matrix;
+                    __m128 result = _mm_loadu_ps(m + 16);
+                    result = _mm_add_ps(result, _mm_mul_ps(
+                        _mm_loadu_ps(m), _mm_shuffle_ps(p, p, 0x00)
+                    ));
+                    result = _mm_add_ps(result, _mm_mul_ps(
+                        _mm_loadu_ps(m + 4), _mm_shuffle_ps(p, p, 0x55)
+                    ));
+                    result = _mm_add_ps(result, _mm_mul_ps(
+                        _mm_loadu_ps(m + 8), _mm_shuffle_ps(p, p, 0xAA)
+                    ));
+                    result = _mm_add_ps(result, _mm_mul_ps(
+                        _mm_loadu_ps(m + 12), _mm_shuffle_ps(p, p, 0xFF)
+                    ));
+                    p = result;
+                    continue;
+                }
+                __m128 c = _mm_max_ps(p, zero);
+                __m128 mapped;
+                if(op.kind == Op::REINHARD) {
+                    mapped = _mm_div_ps(c, _mm_add_ps(c, one));
+                } else {
+                    __m128 numerator = _mm_mul_ps(c, _mm_add_ps(
+                        _mm_mul_ps(c, _mm_set1_ps(2.51f)), _mm_set1_ps(0.03f)
+                    ));
+                    __m128 denominator = _mm_add_ps(_mm_mul_ps(c, _mm_add_ps(
+                        _mm_mul_ps(c, _mm_set1_ps(2.43f)), _mm_set1_ps(0.59f)
+                    )), _mm_set1_ps(0.14f));
+                    mapped = _mm_min_ps(_mm_div_ps(numerator, denominator), one);
+                }
+                // alpha is kept as it is
+                p = _mm_or_ps(_mm_and_ps(rgb, mapped), _mm_andnot_ps(rgb, p));
+            }
+            _mm_storeu_ps(pixels + i * 4, p);
+        }
+#else
+        for(size_t i = 0; i < count; i += 1) {
+            float* p = pixels + i * 4;
+            for(const Op& op: ops) {
+                if(op.kind == Op::MATRIX) {
+                    float result[4];
+                    for(int row = 0; row < 4; row += 1) {
+                        result[row] = op.matrix[16 + row];
+                        for(int col = 0; col < 4; col += 1) {
+                            result[row] += op.matrix[col * 4 + row] * p[col];
+                        }
+                    }
+                    std::copy(result, result + 4, p);
+                    continue;
+                }
+                for(int c = 0; c < 3; c += 1) {
+                    p[c] = op.kind == Op::REINHARD ? reinhard(p[c]) : aces(p[c]);
+                }
+            }
+        }
+#endif
+    }
+
+    // Decodes a row of the surface to linear RGBA floats
+    static void read_row(const Surface& src, int y, float* dest) {
+        dispatch_pixel_format(src.format, [&]<rendering::PixelFormat P>() {
+            using Pixel = rendering::PixelTraits<P>;
+            const typename Pixel::Stored* row
+                = (const typename Pixel::Stored*) src.color
+                + (size_t) y * src.pitch;
+            if constexpr (P == rendering::PixelFormat::RGBA8) {
+                if(src.srgb) {
+                    conversion::unpack_srgb8(row, dest, src.width);
+                } else {
+                    conversion::unpack_rgba8(row, dest, src.width);
+                }
+            } else if constexpr (P == rendering::PixelFormat::RGBA32F) {
+                std::memcpy(dest, row, sizeof(float) * 4 * src.width);
+            } else {
+                for(int x = 0; x < src.width; x += 1) {
+                    Vec<4> c = Pixel::decode(row[x]);
+                    float* d = dest + x * 4;
+                    d[0] = c.r(); d[1] = c.g(); d[2] = c.b(); d[3] = c.a();
+                }
+            }
+        });
+    }
+
+    // Encodes linear RGBA floats into a row of the surface
+    static void write_row(Surface& dest, int y, const float* src) {
+        dispatch_pixel_format(dest.format, [&]<rendering::PixelFormat P>() {
+            using Pixel = rendering::PixelTraits<P>;
+            typename Pixel::Stored* row = (typename Pixel::Stored*) dest.color
+                + (size_t) y * dest.pitch;
+            if constexpr (P == rendering::PixelFormat::RGBA8) {
+                if(dest.srgb) {
+                    conversion::pack_srgb8(src, row, dest.width);
+                } else {
+                    conversion::pack_rgba8(src, row, dest.width);
+                }
+            } else if constexpr (P == rendering::PixelFormat::RGBA32F) {
+                std::memcpy(row, src, sizeof(float) * 4 * dest.width);
+            } else {
+                for(int x = 0; x < dest.width; x += 1) {
+                    const float* c = src + x * 4;
+                    row[x] = Pixel::encode(Vec<4>(c[0], c[1], c[2], c[3]));
+                }
+            }
+        });
+    }
+
+    // 'sum += weight * (a + b)' for 'count' floats
+    static void add_weighted_pair(
+        float* sum, const float* a, const float* b, float weight, size_t count
+    ) {
+        size_t i = 0;
+#ifdef __SSE2__
+        __m128 w = _mm_set1_ps(weight);
+        for(; i + 4 <= count; i += 4) {
+            __m128 pair = _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+            _mm_storeu_ps(
+                sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_mul_ps(pair, w))
+            );
+        }
+#endif
+        for(; i < count; i += 1) {
+            sum[i] += weight * (a[i] + b[i]);
+        }
+    }
+
+    static std::vector<float> gaussian_kernel(double sigma) {
+        if(sigma <= 0.0) {
+            logging::error(
+                "The standard deviation of a blur must be larger than 0 "
+                    "(given was " + std::to_string(sigma) + ")"
+            );
+        }
+        int radius = std::max(1, (int) std::ceil(sigma * 3.0));
+        std::vector<float> kernel(radius + 1);
+        double total = 0.0;
+        for(int i = 0; i <= radius; i += 1) {
+            double weight = std::exp(-(i * i) / (2.0 * sigma * sigma));
+            kernel[i] = (float) weight;
+            total += i == 0 ? weight : weight * 2.0;
+        }
+        for(float& weight: kernel) { weight = (float) (weight / total); }
+        return kernel;
+    }
+
+    void Chain::add_op(const PixelOp& op) {
+        std::vector<PixelOp>& ops = this->stages.size() == 0
+            ? this->source_ops
+            : this->stages.back().ops;
+        ops.push_back(op);
+    }
+
+    void Chain::add_matrix(const float* matrix) {
+        std::vector<PixelOp>& ops = this->stages.size() == 0
+            ? this->source_ops
+            : this->stages.back().ops;
+        // consecutive matrices are multiplied into one
+        if(ops.size() > 0 && ops.back().kind == PixelOp::MATRIX) {
+            compose_matrices(ops.back().matrix, matrix, ops.back().matrix);
+            return;
+        }
+        PixelOp op;
+        op.kind = PixelOp::MATRIX;
+        std::copy(matrix, matrix + 20, op.matrix);
+        ops.push_back(op);
+    }
+
+    void Chain::add_blur(double sigma) {
+        this->stages.push_back({ false, 0.0f, 0.0f, gaussian_kernel(sigma), {} });
+    }
+
+    void Chain::add_bloom(double threshold, double intensity, double sigma) {
+        this->stages.push_back({
+            true, (float) threshold, (float) intensity,
+            gaussian_kernel(sigma), {}
+        });
+    }
+
+    void Chain::add_tonemap(Tonemap tonemap, double exposure) {
+        if(exposure != 1.0) {
+            float matrix[20];
+            identity_matrix(matrix);
+            for(int c = 0; c < 3; c += 1) { matrix[c * 4 + c] = (float) exposure; }
+            this->add_matrix(matrix);
+        }
+        PixelOp op;
+        op.kind = tonemap == Tonemap::REINHARD
+            ? PixelOp::REINHARD : PixelOp::ACES;
+        this->add_op(op);
+    }
+
+    void Chain::add_grading(const Grading& grading) {
+        float matrix[20];
+        // tint
+        identity_matrix(matrix);
+        for(int c = 0; c < 3; c += 1) {
+            matrix[c * 4 + c] = (float) grading.tint[c];
+        }
+        this->add_matrix(matrix);
+        // saturation, mixing each channel with the luminance
+        identity_matrix(matrix);
+        float saturation = (float) grading.saturation;
+        for(int col = 0; col < 3; col += 1) {
+            for(int row = 0; row < 3; row += 1) {
+                matrix[col * 4 + row] = (1.0f - saturation) * LUMINANCE_WEIGHTS[col]
+                    + (col == row ? saturation : 0.0f);
+            }
+        }
+        this->add_matrix(matrix);
+        // contrast and lift
+        identity_matrix(matrix);
+        float contrast = (float) grading.contrast;
+        for(int c = 0; c < 3; c += 1) {
+            matrix[c * 4 + c] = contrast;
+            matrix[16 + c] = 0.5f * (1.0f - contrast) + (float) grading.lift[c];
+        }
+        this->add_matrix(matrix);
+    }
+
+    void Chain::clear() {
+        this->source_ops.clear();
+        this->stages.clear();
+    }
+
+    void Chain::apply(const Surface& src, Surface& dest) {
+        if(src.width != dest.width || src.height != dest.height) {
+            logging::error(
+                "The size of the post-processing source ("
+                    + std::to_string(src.width) + "x"
+                    + std::to_string(src.height)
+                    + ") does not match the size of the destination ("
+                    + std::to_string(dest.width) + "x"
+                    + std::to_string(dest.height) + ")"
+            );
+        }
+        dest.mark_dirty({ 0, 0, dest.width, dest.height });
+        size_t row_floats = (size_t) src.width * 4;
+        if(this->stages.size() == 0) {
+            // a single pass from 'src' to 'dest'
+            threading::parallel_for(src.height, 16, [&](size_t start, size_t end) {
+                std::vector<float> row(row_floats);
+                for(size_t y = start; y < end; y += 1) {
+                    read_row(src, (int) y, row.data());
+                    apply_ops(this->source_ops, row.data(), src.width);
+                    write_row(dest, (int) y, row.data());
+                }
+            });
+            return;
+        }
+        this->current.resize(row_floats * src.height);
+        this->convolved.resize(row_floats * src.height);
+        for(size_t stage_i = 0; stage_i < this->stages.size(); stage_i += 1) {
+            // the first stage reads the source itself
+            const Surface* source = stage_i == 0 ? &src : nullptr;
+            bool last = stage_i == this->stages.size() - 1;
+            this->convolve(this->stages[stage_i], source, dest, last);
+        }
+    }
+
+    void Chain::convolve(
+        const Stage& stage, const Surface* src, Surface& dest, bool last
+    ) {
+        int width = dest.width;
+        int height = dest.height;
+        size_t row_floats = (size_t) width * 4;
+        const std::vector<float>& kernel = stage.kernel;
+        int radius = (int) kernel.size() - 1;
+        // horizontal pass ('current' or 'src' to 'convolved'), with the row
+        // padded by repeating its first and last pixels
+        threading::parallel_for(height, 16, [&](size_t start, size_t end) {
+            std::vector<float> padded((size_t) (width + radius * 2) * 4);
+            for(size_t y = start; y < end; y += 1) {
+                float* row = this->current.data() + y * row_floats;
+                float* center = padded.data() + radius * 4;
+                if(src == nullptr) {
+                    std::copy(row, row + row_floats, center);
+                } else {
+                    read_row(*src, (int) y, center);
+                    apply_ops(this->source_ops, center, width);
+                    // bloom adds to the unblurred image
+                    if(stage.bloom) {
+                        std::copy(center, center + row_floats, row);
+                    }
+                }
+                if(stage.bloom) {
+                    // only the brightness above the threshold is blurred
+                    for(int x = 0; x < width; x += 1) {
+                        float* p = center + x * 4;
+                        for(int c = 0; c < 3; c += 1) {
+                            p[c] = std::max(p[c] - stage.threshold, 0.0f);
+                        }
+                        p[3] = 0.0f;
+                    }
+                }
+                for(int i = 0; i < radius; i += 1) {
+                    std::copy(center, center + 4, padded.data() + i * 4);
+                    std::copy(
+                        center + row_floats - 4, center + row_floats,
+                        center + row_floats + i * 4
+                    );
+                }
+                float* out = this->convolved.data() + y * row_floats;
+                for(size_t i = 0; i < row_floats; i += 1) {
+                    out[i] = center[i] * kernel[0];
+                }
+                for(int i = 1; i <= radius; i += 1) {
+                    add_weighted_pair(
+                        out, center - i * 4, center + i * 4, kernel[i], row_floats
+                    );
+                }
+            }
+        });
+        // vertical pass ('convolved' to 'current' or 'dest'), followed by the
+        // per-pixel effects
+        threading::parallel_for(height, 16, [&](size_t start, size_t end) {
+            std::vector<float> sum(row_floats);
+            for(size_t y = start; y < end; y += 1) {
+                const float* middle = this->convolved.data() + y * row_floats;
+                for(size_t i = 0; i < row_floats; i += 1) {
+                    sum[i] = middle[i] * kernel[0];
+                }
+                for(int i = 1; i <= radius; i += 1) {
+                    size_t above = (size_t) std::max((int) y - i, 0);
+                    size_t below = (size_t) std::min((int) y + i, height - 1);
+                    add_weighted_pair(
+                        sum.data(),
+                        this->convolved.data() + above * row_floats,
+                        this->convolved.data() + below * row_floats,
+                        kernel[i], row_floats
+                    );
+                }
+                float* row = this->current.data() + y * row_floats;
+                if(stage.bloom) {
+                    for(size_t i = 0; i < row_floats; i += 1) {
+                        sum[i] = row[i] + sum[i] * stage.intensity;
+                    }
+                }
+                apply_ops(stage.ops, sum.data(), width);
+                if(last) {
+                    write_row(dest, (int) y, sum.data());
+                } else {
+                    std::copy(sum.begin(), sum.end(), row);
+                }
+            }
+        });
+    }
+
+}
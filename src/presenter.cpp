@@ -0,0 +1,109 @@
+
+#include <druck/window.hpp>
+#include <druck/logging.hpp>
+
+namespace druck::window {
+
+    Presenter::Presenter(
+        const char* title, int width, int height, int fps, int buffer_count,
+        rendering::PixelFormat format, rendering::DepthFormat depth_format
+    ) {
+        if(buffer_count < 2) {
+            logging::error(
+                "A presenter needs at least 2 buffers (given was "
+                    + std::to_string(buffer_count) + ")"
+            );
+        }
+        this->title = title;
+        this->fps = fps;
+        this->window_width = width;
+        this->window_height = height;
+        for(int buffer_i = 0; buffer_i < buffer_count; buffer_i += 1) {
+            this->buffers.push_back(
+                rendering::Surface(width, height, format, depth_format)
+            );
+            this->states.push_back(BufferState::FREE);
+        }
+        this->thread = std::thread([this]() { this->run(); });
+    }
+
+    Presenter::~Presenter() {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->buffer_queued.notify_all();
+        this->thread.join();
+    }
+
+    rendering::Surface& Presenter::acquire() {
+        std::unique_lock<std::mutex> guard(this->lock);
+        for(;;) {
+            for(size_t buffer_i = 0; buffer_i < this->buffers.size(); buffer_i += 1) {
+                if(this->states[buffer_i] != BufferState::FREE) { continue; }
+                this->states[buffer_i] = BufferState::ACQUIRED;
+                return this->buffers[buffer_i];
+            }
+            this->buffer_freed.wait(guard);
+        }
+    }
+
+    void Presenter::present(rendering::Surface& buffer) {
+        size_t buffer_i = 0;
+        while(buffer_i < this->buffers.size()
+            && &this->buffers[buffer_i] != &buffer) {
+            buffer_i += 1;
+        }
+        if(buffer_i == this->buffers.size()) {
+            logging::error("Only buffers owned by the presenter can be presented");
+        }
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            if(this->states[buffer_i] != BufferState::ACQUIRED) {
+                logging::error(
+                    "Only acquired buffers can be presented (each buffer "
+                        "needs to be acquired again after presenting it)"
+                );
+            }
+            this->states[buffer_i] = BufferState::QUEUED;
+            this->queue.push_back(buffer_i);
+        }
+        this->buffer_queued.notify_one();
+    }
+
+    bool Presenter::should_close() const { return this->closing; }
+    double Presenter::delta_time() const { return this->frame_time; }
+    int Presenter::width() const { return this->window_width; }
+    int Presenter::height() const { return this->window_height; }
+
+    void Presenter::run() {
+        init(this->title.c_str(), this->window_width, this->window_height, this->fps);
+        for(;;) {
+            size_t buffer_i;
+            {
+                std::unique_lock<std::mutex> guard(this->lock);
+                this->buffer_queued.wait(guard, [this]() {
+                    return this->stopping || !this->queue.empty();
+                });
+                if(this->queue.empty()) { break; } // stopping
+                buffer_i = this->queue.front();
+                this->queue.pop_front();
+                this->states[buffer_i] = BufferState::DISPLAYED;
+            }
+            // blocks until the frame is shown (paced by the target FPS)
+            display_buffer(this->buffers[buffer_i]);
+            this->closing = should_close();
+            this->frame_time = delta_time();
+            this->window_width = width();
+            this->window_height = height();
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                // the buffer contents have been uploaded to the texture
+                this->states[buffer_i] = BufferState::FREE;
+            }
+            this->buffer_freed.notify_all();
+        }
+        close();
+    }
+
+}
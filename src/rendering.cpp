@@ -1,7 +1,10 @@
 
-#include <druck/window.hpp>
+#include <druck/rendering.hpp>
 #include <druck/logging.hpp>
+#include <druck/blit.hpp>
 #include <cstring>
+#include <new>
+#include <atomic>
 #include <string>
 #include <iostream>
 #include <cassert>
@@ -11,68 +14,185 @@ namespace druck::rendering {
 
     using namespace druck::math;
     namespace logging = druck::logging;
-    
 
-    Surface::Surface(int width, int height) {
+
+    ShadingRateImage::ShadingRateImage(
+        int surface_width, int surface_height, int tile_size, ShadingRate rate
+    ) {
+        if(tile_size <= 0 || tile_size % 4 != 0) {
+            logging::error(
+                "The tile size of a shading rate image must be a positive "
+                    "multiple of 4 (given was " + std::to_string(tile_size) + ")"
+            );
+        }
+        this->tile_size = tile_size;
+        this->width = (surface_width + tile_size - 1) / tile_size;
+        this->height = (surface_height + tile_size - 1) / tile_size;
+        this->rates.assign((size_t) this->width * this->height, rate);
+    }
+
+    void ShadingRateImage::set_rate(int tile_x, int tile_y, ShadingRate rate) {
+        assert(tile_x >= 0 && tile_x < this->width);
+        assert(tile_y >= 0 && tile_y < this->height);
+        this->rates[(size_t) tile_y * this->width + tile_x] = rate;
+    }
+
+    ShadingRate ShadingRateImage::get_rate(int tile_x, int tile_y) const {
+        assert(tile_x >= 0 && tile_x < this->width);
+        assert(tile_y >= 0 && tile_y < this->height);
+        return this->rates[(size_t) tile_y * this->width + tile_x];
+    }
+
+    bool ShadingRateImage::covers(
+        int surface_width, int surface_height
+    ) const {
+        return (int64_t) this->width * this->tile_size >= surface_width
+            && (int64_t) this->height * this->tile_size >= surface_height;
+    }
+
+
+    bool Rect::is_empty() const {
+        return this->width <= 0 || this->height <= 0;
+    }
+
+    Rect Rect::united(const Rect& other) const {
+        if(this->is_empty()) { return other; }
+        if(other.is_empty()) { return *this; }
+        int x = std::min(this->x, other.x);
+        int y = std::min(this->y, other.y);
+        int end_x = std::max(this->x + this->width, other.x + other.width);
+        int end_y = std::max(this->y + this->height, other.y + other.height);
+        return { x, y, end_x - x, end_y - y };
+    }
+
+    Rect Rect::intersected(const Rect& other) const {
+        int x = std::max(this->x, other.x);
+        int y = std::max(this->y, other.y);
+        int end_x = std::min(this->x + this->width, other.x + other.width);
+        int end_y = std::min(this->y + this->height, other.y + other.height);
+        if(end_x <= x || end_y <= y) { return Rect(); }
+        return { x, y, end_x - x, end_y - y };
+    }
+
+
+    // Rows are padded to a multiple of the alignment for both buffers
+    // (pixel sizes are powers of 2, so this only depends on the smaller one)
+    int Surface::padded_pitch(
+        int width, PixelFormat format, DepthFormat depth_format
+    ) {
+        size_t smallest = std::min(
+            pixel_format_size(format), depth_format_size(depth_format)
+        );
+        int multiple = std::max((int) (SURFACE_ALIGNMENT / smallest), 1);
+        return (width + multiple - 1) / multiple * multiple;
+    }
+
+    static void* alloc_pixels(int pitch, int height, size_t pixel_size) {
+        size_t size = (size_t) pitch * height * pixel_size;
+        return new (std::align_val_t(SURFACE_ALIGNMENT)) uint8_t[size];
+    }
+
+    static void free_pixels(void* pixels) {
+        operator delete[](pixels, std::align_val_t(SURFACE_ALIGNMENT));
+    }
+
+    static uint64_t next_generation() {
+        static std::atomic<uint64_t> generations = 1;
+        return generations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Surface::Surface(
+        int width, int height, PixelFormat format, DepthFormat depth_format
+    ) {
         if(width <= 0) {
             logging::error(
-                std::string("Surface width must be larger than 0 (given was ") 
+                std::string("Surface width must be larger than 0 (given was ")
                     + std::to_string(width) + ")"
             );
         }
         if(height <= 0) {
             logging::error(
-                std::string("Surface height must be larger than 0 (given was ") 
+                std::string("Surface height must be larger than 0 (given was ")
                     + std::to_string(height) + ")"
             );
         }
         this->width = width;
         this->height = height;
-        this->color = new Color[width * height];
-        this->depth = new float[width * height];
+        this->format = format;
+        this->depth_format = depth_format;
+        this->pitch = padded_pitch(width, format, depth_format);
+        this->color = alloc_pixels(
+            this->pitch, height, pixel_format_size(format)
+        );
+        this->depth = alloc_pixels(
+            this->pitch, height, depth_format_size(depth_format)
+        );
+        this->capacity = (size_t) this->pitch * height;
+        this->generation = next_generation();
         this->clear();
     }
 
     Surface::Surface(
-        const Color* color, const float* depth, int width, int height
+        const void* color, const void* depth, int width, int height,
+        PixelFormat format, DepthFormat depth_format
     ) {
         if(width <= 0) {
             logging::error(
-                std::string("Surface width must be larger than 0 (given was ") 
+                std::string("Surface width must be larger than 0 (given was ")
                     + std::to_string(width) + ")"
             );
         }
         if(height <= 0) {
             logging::error(
-                std::string("Surface height must be larger than 0 (given was ") 
+                std::string("Surface height must be larger than 0 (given was ")
                     + std::to_string(height) + ")"
             );
         }
         assert(color != nullptr);
         this->width = width;
         this->height = height;
-        this->color = new Color[width * height];
+        this->format = format;
+        this->depth_format = depth_format;
+        this->pitch = padded_pitch(width, format, depth_format);
+        // the given data is tightly packed, while rows here are padded
+        auto copy_rows = [&](void* dest, const void* src, size_t pixel_size) {
+            for(int y = 0; y < height; y += 1) {
+                std::memcpy(
+                    (uint8_t*) dest + (size_t) y * this->pitch * pixel_size,
+                    (const uint8_t*) src + (size_t) y * width * pixel_size,
+                    width * pixel_size
+                );
+            }
+        };
+        size_t pixel_size = pixel_format_size(format);
+        this->color = alloc_pixels(this->pitch, height, pixel_size);
+        copy_rows(this->color, color, pixel_size);
         if(depth == nullptr) {
             this->depth = nullptr;
         } else {
-            this->depth = new float[width * height];
-        }
-        for(int y = 0; y < height; y += 1) {
-            for(int x = 0; x < width; x += 1) {
-                int offset = y * width + x;
-                this->color[offset] = color[offset];
-                if(depth != nullptr) {
-                    this->depth[offset] = depth[offset];
-                }
-            }
+            size_t depth_size = depth_format_size(depth_format);
+            this->depth = alloc_pixels(this->pitch, height, depth_size);
+            copy_rows(this->depth, depth, depth_size);
         }
+        this->capacity = (size_t) this->pitch * height;
+        this->generation = next_generation();
+        this->dirty = { 0, 0, width, height };
     }
 
     Surface::Surface(Surface&& other) {
+        this->srgb = other.srgb;
+        this->format = other.format;
         this->color = other.color;
+        this->depth_format = other.depth_format;
         this->depth = other.depth;
         this->width = other.width;
         this->height = other.height;
+        this->pitch = other.pitch;
+        this->dirty = other.dirty;
+        this->capacity = other.capacity;
+        this->generation = other.generation;
+        other.capacity = 0;
+        other.generation = 0;
         other.color = nullptr;
         other.depth = nullptr;
         other.width = 0;
@@ -81,14 +201,23 @@ namespace druck::rendering {
 
     Surface& Surface::operator=(Surface&& other) noexcept {
         if(this == &other) { return *this; }
-        delete[] this->color;
+        free_pixels(this->color);
         if(this->depth != nullptr) {
-            delete[] this->depth;
+            free_pixels(this->depth);
         }
+        this->srgb = other.srgb;
+        this->format = other.format;
         this->color = other.color;
+        this->depth_format = other.depth_format;
         this->depth = other.depth;
         this->width = other.width;
         this->height = other.height;
+        this->pitch = other.pitch;
+        this->dirty = other.dirty;
+        this->capacity = other.capacity;
+        this->generation = other.generation;
+        other.capacity = 0;
+        other.generation = 0;
         other.color = nullptr;
         other.depth = nullptr;
         other.width = 0;
@@ -98,11 +227,11 @@ namespace druck::rendering {
 
     Surface::~Surface() {
         if(this->color != nullptr) {
-            delete[] this->color;
+            free_pixels(this->color);
             this->color = nullptr;
         }
         if(this->depth != nullptr) {
-            delete[] this->depth;
+            free_pixels(this->depth);
             this->depth = nullptr;
         }
     }
@@ -116,24 +245,72 @@ namespace druck::rendering {
         return this->contains(pixel.x(), pixel.y());
     }
 
+    template<PixelFormat P>
+    static Vec<4> read_pixel(const void* color, int offset) {
+        using Stored = typename PixelTraits<P>::Stored;
+        return PixelTraits<P>::decode(((const Stored*) color)[offset]);
+    }
+
+    template<PixelFormat P>
+    static void write_pixel(void* color, int offset, const Vec<4>& c) {
+        using Stored = typename PixelTraits<P>::Stored;
+        ((Stored*) color)[offset] = PixelTraits<P>::encode(c);
+    }
+
     Color Surface::get_color_at(int x, int y) const {
-        if(!this->contains(x, y)) { return BLACK; }
-        return this->color[y * this->width + x];
+        if(!this->contains(x, y)) {
+            return PixelTraits<PixelFormat::RGBA8>::cleared;
+        }
+        int offset = y * this->pitch + x;
+        if(this->format == PixelFormat::RGBA8) {
+            return ((const Color*) this->color)[offset];
+        }
+        return Color::from_floats(
+            dispatch_pixel_format(this->format, [&]<PixelFormat P>() {
+                return read_pixel<P>(this->color, offset);
+            })
+        );
     }
 
     void Surface::set_color_at(int x, int y, Color c) {
         if(!this->contains(x, y)) { return; }
-        this->color[y * this->width + x] = c;
+        this->mark_dirty({ x, y, 1, 1 });
+        int offset = y * this->pitch + x;
+        if(this->format == PixelFormat::RGBA8) {
+            ((Color*) this->color)[offset] = c;
+            return;
+        }
+        dispatch_pixel_format(this->format, [&]<PixelFormat P>() {
+            write_pixel<P>(this->color, offset, c.to_floats());
+        });
+    }
+
+    template<DepthFormat D>
+    static double read_depth(const void* depth, int offset) {
+        using Stored = typename DepthTraits<D>::Stored;
+        return DepthTraits<D>::decode(((const Stored*) depth)[offset]);
+    }
+
+    template<DepthFormat D>
+    static void write_depth(void* depth, int offset, double d) {
+        using Stored = typename DepthTraits<D>::Stored;
+        ((Stored*) depth)[offset] = DepthTraits<D>::encode(d);
     }
 
     double Surface::get_depth_at(int x, int y) const {
         if(this->depth == nullptr || !this->contains(x, y)) { return INFINITY; }
-        return this->depth[y * this->width + x];
+        int offset = y * this->pitch + x;
+        return dispatch_depth_format(this->depth_format, [&]<DepthFormat D>() {
+            return read_depth<D>(this->depth, offset);
+        });
     }
 
     void Surface::set_depth_at(int x, int y, double d) {
         if(this->depth == nullptr || !this->contains(x, y)) { return; }
-        this->depth[y * this->width + x] = d;
+        int offset = y * this->pitch + x;
+        dispatch_depth_format(this->depth_format, [&]<DepthFormat D>() {
+            write_depth<D>(this->depth, offset, d);
+        });
     }
 
     Vec<4> Surface::sample(const Vec<2>& uv) const {
@@ -148,36 +325,107 @@ namespace druck::rendering {
         int y_px = this->height - static_cast<int>(v * this->height);
         if(y_px >= this->height) { y_px = this->height - 1; }
         // read the color and return as normalized vector
-        Color color = this->color[y_px * this->width + x_px];
-        return Vec<4>(
-            color.r / 255.0, color.g / 255.0, color.b / 255.0, color.a / 255
-        );
+        int offset = y_px * this->pitch + x_px;
+        if(this->format == PixelFormat::RGBA8) {
+            float c[4];
+            const Color* texel = (const Color*) this->color + offset;
+            if(this->srgb) {
+                conversion::unpack_srgb8(texel, c, 1);
+            } else {
+                conversion::unpack_rgba8(texel, c, 1);
+            }
+            return Vec<4>(c[0], c[1], c[2], c[3]);
+        }
+        return dispatch_pixel_format(this->format, [&]<PixelFormat P>() {
+            return read_pixel<P>(this->color, offset);
+        });
+    }
+
+    void Surface::read_colors(Color* dest) const {
+        this->read_colors(dest, { 0, 0, this->width, this->height });
+    }
+
+    void Surface::read_colors(Color* dest, const Rect& area) const {
+        dispatch_pixel_format(this->format, [&]<PixelFormat P>() {
+            for(int y = 0; y < area.height; y += 1) {
+                int offset = (area.y + y) * this->pitch + area.x;
+                Color* dest_row = dest + (size_t) y * area.width;
+                if constexpr (P == PixelFormat::RGBA8) {
+                    std::memcpy(
+                        dest_row, (const Color*) this->color + offset,
+                        sizeof(Color) * area.width
+                    );
+                } else {
+                    for(int x = 0; x < area.width; x += 1) {
+                        dest_row[x] = Color::from_floats(
+                            read_pixel<P>(this->color, offset + x)
+                        );
+                    }
+                }
+            }
+        });
+    }
+
+    void Surface::mark_dirty(const Rect& area) {
+        Rect bounds = { 0, 0, this->width, this->height };
+        this->dirty = this->dirty.united(area.intersected(bounds));
+    }
+
+    void Surface::clear_dirty() {
+        this->dirty = Rect();
+    }
+
+    void Surface::verify_draw_state(const DrawState& state) const {
+        const ShadingRateImage* rates = state.shading_rate_image;
+        if(rates != nullptr && !rates->covers(this->width, this->height)) {
+            logging::error(
+                "The shading rate image (" + std::to_string(rates->width)
+                    + "x" + std::to_string(rates->height) + " tiles of "
+                    + std::to_string(rates->tile_size)
+                    + " pixels) does not cover the surface ("
+                    + std::to_string(this->width) + "x"
+                    + std::to_string(this->height) + ")"
+            );
+        }
     }
 
     void Surface::resize(int width, int height) {
         if(width == this->width && height == this->height) { return; }
         if(width <= 0) {
             logging::error(
-                std::string("Surface width must be larger than 0 (given was ") 
+                std::string("Surface width must be larger than 0 (given was ")
                     + std::to_string(width) + ")"
             );
         }
         if(height <= 0) {
             logging::error(
-                std::string("Surface height must be larger than 0 (given was ") 
+                std::string("Surface height must be larger than 0 (given was ")
                     + std::to_string(height) + ")"
             );
         }
         this->width = width;
         this->height = height;
+        this->pitch = padded_pitch(width, this->format, this->depth_format);
+        this->dirty = Rect();
+        this->generation = next_generation();
+        if((size_t) this->pitch * height <= this->capacity) {
+            // the existing buffers are large enough
+            this->clear();
+            return;
+        }
         if(this->color != nullptr) {
-            delete[] this->color;
+            free_pixels(this->color);
         }
-        this->color = new Color[width * height];
+        this->color = alloc_pixels(
+            this->pitch, height, pixel_format_size(this->format)
+        );
         if(this->depth != nullptr) {
-            delete[] this->depth;
-            this->depth = new float[width * height];
+            free_pixels(this->depth);
+            this->depth = alloc_pixels(
+                this->pitch, height, depth_format_size(this->depth_format)
+            );
         }
+        this->capacity = (size_t) this->pitch * height;
         this->clear();
     }
 
@@ -186,32 +434,65 @@ namespace druck::rendering {
     }
 
     void Surface::clear() {
-        for(int i = 0; i < this->width * this->height; i += 1) {
-            this->color[i] = BLACK;
-        }
+        this->mark_dirty({ 0, 0, this->width, this->height });
+        // padding is cleared as well, so that whole rows can be filled
+        int pixel_count = this->pitch * this->height;
+        dispatch_pixel_format(this->format, [&]<PixelFormat P>() {
+            using Stored = typename PixelTraits<P>::Stored;
+            Stored* color = (Stored*) this->color;
+            for(int i = 0; i < pixel_count; i += 1) {
+                color[i] = PixelTraits<P>::cleared;
+            }
+        });
         if(this->depth == nullptr) { return; }
-        for(int i = 0; i < this->width * this->height; i += 1) {
-            this->depth[i] = INFINITY;
-        }
+        dispatch_depth_format(this->depth_format, [&]<DepthFormat D>() {
+            using Stored = typename DepthTraits<D>::Stored;
+            Stored* depth = (Stored*) this->depth;
+            for(int i = 0; i < pixel_count; i += 1) {
+                depth[i] = DepthTraits<D>::cleared;
+            }
+        });
     }
 
     void Surface::blit_buffer(
-        const Surface& src, 
+        const Surface& src,
         int dest_pos_x, int dest_pos_y,
         int dest_width, int dest_height
     ) {
-        int dest_end_x = dest_pos_x + dest_width;
-        int dest_end_y = dest_pos_y + dest_height;
-        for(int dest_x = dest_pos_x; dest_x < dest_end_x; dest_x += 1) {
-            for(int dest_y = dest_pos_y; dest_y < dest_end_y; dest_y += 1) {
-                float perc_x = (float) (dest_x - dest_pos_x) / dest_width;
-                float perc_y = (float) (dest_y - dest_pos_y) / dest_height;
-                int src_x = (int) (perc_x * src.width);
-                int src_y = (int) (perc_y * src.height);
-                Color pixel = src.get_color_at(src_x, src_y);
-                this->set_color_at(dest_x, dest_y, pixel);
-            }
+        blit::scaled(
+            src, *this, dest_pos_x, dest_pos_y, dest_width, dest_height
+        );
+    }
+
+    void Surface::blit_buffer_dirty(
+        const Surface& src,
+        int dest_pos_x, int dest_pos_y,
+        int dest_width, int dest_height
+    ) {
+        if(src.dirty.is_empty() || dest_width <= 0 || dest_height <= 0) {
+            return;
         }
+        // map the dirty source area (grown by one pixel for the filter and
+        // rounding) to the destination
+        auto map = [](int src_pos, int src_size, int dest_size, bool round_up) {
+            int64_t scaled = (int64_t) src_pos * dest_size;
+            int64_t mapped = scaled / src_size;
+            if(round_up && scaled % src_size != 0) { mapped += 1; }
+            return (int) mapped;
+        };
+        const Rect& d = src.dirty;
+        int start_x = map(d.x - 1, src.width, dest_width, false);
+        int end_x = map(d.x + d.width + 1, src.width, dest_width, true);
+        int start_y = map(d.y - 1, src.height, dest_height, false);
+        int end_y = map(d.y + d.height + 1, src.height, dest_height, true);
+        Rect region = {
+            dest_pos_x + start_x, dest_pos_y + start_y,
+            end_x - start_x, end_y - start_y
+        };
+        blit::scaled(
+            src, *this, dest_pos_x, dest_pos_y, dest_width, dest_height,
+            region
+        );
     }
 
 }
@@ -0,0 +1,114 @@
+
+#include <druck/resolution.hpp>
+#include <druck/logging.hpp>
+#include <cmath>
+#include <string>
+
+namespace druck::resolution {
+
+    namespace logging = druck::logging;
+
+
+    // weight of the newest frame in the moving average of frame times
+    #define RESOLUTION_AVERAGE_WEIGHT 0.2
+    // frame times above this factor of the target lower the scale
+    // immediately, while the average only needs to be above 'OVER' and is
+    // only checked every 'DOWN_DELAY' frames
+    #define RESOLUTION_SPIKE 1.5
+    #define RESOLUTION_OVER 1.05
+    #define RESOLUTION_DOWN_DELAY 4
+    // the scale is only raised again after 'UP_DELAY' frames below 'UNDER',
+    // and by at most 'MAX_STEP_UP' at once, so that it doesn't oscillate
+    #define RESOLUTION_UNDER 0.8
+    #define RESOLUTION_UP_DELAY 30
+    #define RESOLUTION_MAX_STEP_UP 1.1
+
+    Controller::Controller(
+        double target_frame_time, double min_scale, double max_scale
+    ) {
+        if(target_frame_time <= 0.0) {
+            logging::error(
+                "The target frame time must be larger than 0 (given was "
+                    + std::to_string(target_frame_time) + ")"
+            );
+        }
+        if(min_scale <= 0.0 || min_scale > max_scale) {
+            logging::error(
+                "The minimum scale must be larger than 0 and at most "
+                    "the maximum scale (given were "
+                    + std::to_string(min_scale) + " and "
+                    + std::to_string(max_scale) + ")"
+            );
+        }
+        this->target_frame_time = target_frame_time;
+        this->min_scale = min_scale;
+        this->max_scale = max_scale;
+        this->current_scale = max_scale;
+        this->average_frame_time = target_frame_time;
+        this->frame_start = std::chrono::steady_clock::now();
+    }
+
+    void Controller::begin_frame() {
+        this->frame_start = std::chrono::steady_clock::now();
+    }
+
+    void Controller::end_frame() {
+        auto frame_end = std::chrono::steady_clock::now();
+        this->update(
+            std::chrono::duration<double>(frame_end - this->frame_start).count()
+        );
+    }
+
+    void Controller::update(double frame_time) {
+        this->average_frame_time
+            = this->average_frame_time * (1.0 - RESOLUTION_AVERAGE_WEIGHT)
+            + frame_time * RESOLUTION_AVERAGE_WEIGHT;
+        this->frames_since_change += 1;
+        double target = this->target_frame_time;
+        // rendering time is roughly proportional to the number of pixels,
+        // which is the scale squared
+        double new_scale = this->current_scale;
+        if(frame_time > target * RESOLUTION_SPIKE) {
+            new_scale = this->current_scale * std::sqrt(target / frame_time);
+        } else if(this->average_frame_time > target * RESOLUTION_OVER
+            && this->frames_since_change >= RESOLUTION_DOWN_DELAY) {
+            new_scale = this->current_scale
+                * std::sqrt(target / this->average_frame_time);
+        } else if(this->average_frame_time < target * RESOLUTION_UNDER
+            && this->frames_since_change >= RESOLUTION_UP_DELAY) {
+            double ideal = std::sqrt(target / this->average_frame_time);
+            new_scale = this->current_scale
+                * std::min(ideal, RESOLUTION_MAX_STEP_UP);
+        }
+        new_scale = std::clamp(new_scale, this->min_scale, this->max_scale);
+        if(new_scale == this->current_scale) { return; }
+        // expect the frame time to change with the number of pixels
+        double pixel_ratio = (new_scale * new_scale)
+            / (this->current_scale * this->current_scale);
+        this->average_frame_time *= pixel_ratio;
+        this->current_scale = new_scale;
+        this->frames_since_change = 0;
+    }
+
+    double Controller::scale() const {
+        return this->current_scale;
+    }
+
+    void Controller::apply(
+        rendering::Surface& target, int output_width, int output_height
+    ) const {
+        int width = std::max((int) std::round(output_width * this->current_scale), 1);
+        int height = std::max((int) std::round(output_height * this->current_scale), 1);
+        target.resize(width, height);
+    }
+
+    void Controller::present(
+        const rendering::Surface& target, rendering::Surface& output,
+        blit::Filter filter
+    ) const {
+        blit::scaled(
+            target, output, 0, 0, output.width, output.height, filter
+        );
+    }
+
+}
@@ -1,6 +1,8 @@
 
 #include <druck/resources.hpp>
 #include <druck/logging.hpp>
+#include <druck/image.hpp>
+#include <druck/optimization.hpp>
 #include <string>
 #include <fstream>
 #include <iostream>
@@ -8,6 +10,9 @@
 #include <nlohmann/json.hpp>
 #include <filesystem>
 #include <unordered_set>
+#ifndef DRUCK_HEADLESS
+    #include <raylib.h>
+#endif
 
 using json = nlohmann::json;
 namespace fs = std::filesystem;
@@ -35,13 +40,73 @@ namespace druck::resources {
     }
 
 
-    rendering::Mesh<ModelVertex> read_obj_model(const char* file) {
+    // The indices of the position, UV and normal of a face corner in an
+    // OBJ file (starting at 0)
+    struct ObjCorner {
+        size_t pos;
+        size_t uv;
+        size_t norm;
+
+        bool operator==(const ObjCorner& other) const {
+            return this->pos == other.pos && this->uv == other.uv
+                && this->norm == other.norm;
+        }
+    };
+
+    struct ObjCornerHash {
+        size_t operator()(const ObjCorner& corner) const {
+            size_t hash = std::hash<size_t>()(corner.pos);
+            hash = hash * 31 + std::hash<size_t>()(corner.uv);
+            hash = hash * 31 + std::hash<size_t>()(corner.norm);
+            return hash;
+        }
+    };
+
+
+    template<typename V>
+    static void optimize_loaded_mesh(
+        rendering::Mesh<V>& mesh, const char* file
+    ) {
+        size_t vertex_count = mesh.vertices.size();
+        rendering::MeshOptimization result = rendering::optimize_mesh(mesh);
+        logging::info(
+            "Optimized mesh from '" + std::string(file) + "' ("
+                + std::to_string(mesh.elements.size()) + " triangles, "
+                + std::to_string(vertex_count) + " -> "
+                + std::to_string(mesh.vertices.size()) + " vertices, ACMR "
+                + std::to_string(result.acmr_before) + " -> "
+                + std::to_string(result.acmr_after) + ")"
+        );
+    }
+
+
+    rendering::Mesh<ModelVertex> read_obj_model(
+        const char* file, bool optimize
+    ) {
         std::string content = read_string(file);
         auto lines = std::istringstream(content);
         auto positions = std::vector<Vec<3>>();
         auto uv_mappings = std::vector<Vec<2>>();
         auto normals = std::vector<Vec<3>>();
         auto mesh = rendering::Mesh<ModelVertex>();
+        // corners with the same position, UV and normal share one vertex
+        auto corner_vertices = std::unordered_map<
+            ObjCorner, uint32_t, ObjCornerHash
+        >();
+        auto add_corner = [&](const std::string& corner) {
+            auto indices = std::istringstream(corner);
+            std::string pos; std::getline(indices, pos, '/');
+            std::string uv; std::getline(indices, uv, '/');
+            std::string norm; std::getline(indices, norm, '/');
+            ObjCorner key = { stoul(pos) - 1, stoul(uv) - 1, stoul(norm) - 1 };
+            auto existing = corner_vertices.find(key);
+            if(existing != corner_vertices.end()) { return existing->second; }
+            uint32_t idx = mesh.add_vertex({
+                positions[key.pos], uv_mappings[key.uv], normals[key.norm]
+            });
+            corner_vertices[key] = idx;
+            return idx;
+        };
         size_t line_n = 0;
         for(std::string line; std::getline(lines, line); line_n += 1) {
             auto parts = std::istringstream(line);
@@ -62,41 +127,22 @@ namespace druck::resources {
             } else if(type == "vt") {
                 uv_mappings.push_back(Vec<2>(stod(a), stod(b)));
             } else if(type == "f") {
-                auto a_indices = std::istringstream(a);
-                std::string a_pos; std::getline(a_indices, a_pos, '/');
-                std::string a_uv; std::getline(a_indices, a_uv, '/');
-                std::string a_norm; std::getline(a_indices, a_norm, '/');
-                uint32_t a_idx = mesh.add_vertex({
-                    positions[stoul(a_pos) - 1], 
-                    uv_mappings[stoul(a_uv) - 1],
-                    normals[stoul(a_norm) - 1]
-                });
-                auto b_indices = std::istringstream(b);
-                std::string b_pos; std::getline(b_indices, b_pos, '/');
-                std::string b_uv; std::getline(b_indices, b_uv, '/');
-                std::string b_norm; std::getline(b_indices, b_norm, '/');
-                uint32_t b_idx = mesh.add_vertex({
-                    positions[stoul(b_pos) - 1], 
-                    uv_mappings[stoul(b_uv) - 1],
-                    normals[stoul(b_norm) - 1]
-                });
-                auto c_indices = std::istringstream(c);
-                std::string c_pos; std::getline(c_indices, c_pos, '/');
-                std::string c_uv; std::getline(c_indices, c_uv, '/');
-                std::string c_norm; std::getline(c_indices, c_norm, '/');
-                uint32_t c_idx = mesh.add_vertex({
-                    positions[stoul(c_pos) - 1], 
-                    uv_mappings[stoul(c_uv) - 1],
-                    normals[stoul(c_norm) - 1]
-                });
+                uint32_t a_idx = add_corner(a);
+                uint32_t b_idx = add_corner(b);
+                uint32_t c_idx = add_corner(c);
                 mesh.add_element(a_idx, b_idx, c_idx);
             }
         }
+        if(optimize) { optimize_loaded_mesh(mesh, file); }
         return mesh;
     }
 
 
     rendering::Surface read_texture(const char* file) {
+#ifdef DRUCK_HEADLESS
+        // without raylib only PNG and PPM files can be read
+        return image::read_image(file);
+#else
         logging::info("Reading file '" + std::string(file) + "'");
         Image img = LoadImage(file);
         if(!IsImageReady(img)) {
@@ -106,12 +152,13 @@ namespace druck::resources {
         }
         Color* data = LoadImageColors(img);
         auto surface = rendering::Surface(
-            (rendering::Color*) data, nullptr, 
+            data, nullptr, 
             img.width, img.height
         );
         UnloadImageColors(data);
         UnloadImage(img);
         return surface;
+#endif
     }
 
 
@@ -653,7 +700,7 @@ namespace druck::resources {
         }
     }
 
-    resources::RiggedModel read_gltf_model(const char* file) {
+    resources::RiggedModel read_gltf_model(const char* file, bool optimize) {
         fs::path dir = fs::path(file).parent_path();
         auto stream = open_stream(file);
         json j = json::parse(stream);
@@ -666,6 +713,11 @@ namespace druck::resources {
         json& scene = j["scenes"][(size_t) j["scene"]];
         collect_gltf_meshes(j, scene["nodes"], model, file, buffers);
         read_gltf_animations(j, root_node, model, buffers, joint_nodes, file);
+        if(optimize) {
+            for(RiggedModelMesh& mesh: model.meshes) {
+                optimize_loaded_mesh(mesh.mesh, file);
+            }
+        }
         return model;
     }
 
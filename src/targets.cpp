@@ -0,0 +1,78 @@
+
+#include <druck/targets.hpp>
+
+namespace druck::rendering {
+
+    TargetPool::TargetPool(uint64_t max_idle_frames) {
+        this->max_idle_frames = max_idle_frames;
+    }
+
+    Surface TargetPool::acquire(
+        int width, int height, PixelFormat format, DepthFormat depth_format
+    ) {
+        size_t pixel_count = (size_t) height
+            * Surface::padded_pitch(width, format, depth_format);
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            // use the smallest matching surface that fits
+            size_t best = this->entries.size();
+            for(size_t entry_i = 0; entry_i < this->entries.size(); entry_i += 1) {
+                const Surface& surface = this->entries[entry_i].surface;
+                bool matches = surface.format == format
+                    && surface.depth_format == depth_format
+                    && surface.depth != nullptr
+                    && surface.capacity >= pixel_count;
+                if(!matches) { continue; }
+                if(best == this->entries.size()
+                    || surface.capacity < this->entries[best].surface.capacity) {
+                    best = entry_i;
+                }
+            }
+            if(best < this->entries.size()) {
+                Surface surface = std::move(this->entries[best].surface);
+                this->entries[best] = std::move(this->entries.back());
+                this->entries.pop_back();
+                surface.srgb = false;
+                if(surface.width == width && surface.height == height) {
+                    surface.clear();
+                } else {
+                    // fits the capacity, so this does not reallocate
+                    surface.resize(width, height);
+                }
+                return surface;
+            }
+        }
+        return Surface(width, height, format, depth_format);
+    }
+
+    void TargetPool::release(Surface&& surface) {
+        if(surface.color == nullptr) { return; }
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->entries.push_back({ std::move(surface), this->frame });
+    }
+
+    void TargetPool::end_frame() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->frame += 1;
+        for(size_t entry_i = 0; entry_i < this->entries.size();) {
+            uint64_t idle = this->frame - this->entries[entry_i].released_frame;
+            if(idle > this->max_idle_frames) {
+                this->entries[entry_i] = std::move(this->entries.back());
+                this->entries.pop_back();
+            } else {
+                entry_i += 1;
+            }
+        }
+    }
+
+    void TargetPool::clear() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->entries.clear();
+    }
+
+    size_t TargetPool::pooled_count() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->entries.size();
+    }
+
+}
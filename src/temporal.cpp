@@ -0,0 +1,614 @@
+
+#include <druck/temporal.hpp>
+#include <druck/threading.hpp>
+#include <druck/logging.hpp>
+#include <cstring>
+#include <cmath>
+#include <string>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace druck::rendering {
+
+    namespace logging = druck::logging;
+
+
+    // Returns the point shown at the given pixel with the given depth
+    static Vec<3> unproject(
+        const Mat<4>& inverse_view_projection, double x, double y, double depth,
+        int width, int height
+    ) {
+        Vec<3> ndc = pixel_to_ndc(x, y, depth, width, height);
+        Vec<4> world = inverse_view_projection * ndc.with(1.0);
+        return world.swizzle<3>("xyz") / world.w();
+    }
+
+    // Computes the pixel position of the given point and its distance
+    // to the camera (false if it is behind the camera)
+    static bool project(
+        const Mat<4>& view_projection, const Vec<3>& point,
+        int width, int height, Vec<2>& pixel, double& distance
+    ) {
+        Vec<4> clip = view_projection * point.with(1.0);
+        if(clip.w() <= 0.0) { return false; }
+        Vec<3> ndc = clip.swizzle<3>("xyz") / clip.w();
+        pixel = (ndc_to_pixel_space(width, height) * ndc).swizzle<2>("xy");
+        distance = clip.w();
+        return true;
+    }
+
+    // Copies the color and depth of 'src' into 'dest', reallocating it if
+    // the size or formats don't match
+    static void copy_surface(const Surface& src, Surface& dest) {
+        bool matches = dest.width == src.width && dest.height == src.height
+            && dest.format == src.format
+            && dest.depth_format == src.depth_format;
+        if(!matches) {
+            dest = Surface(src.width, src.height, src.format, src.depth_format);
+        }
+        dest.srgb = src.srgb;
+        size_t pixel_count = (size_t) src.pitch * src.height;
+        std::memcpy(
+            dest.color, src.color, pixel_count * pixel_format_size(src.format)
+        );
+        std::memcpy(
+            dest.depth, src.depth,
+            pixel_count * depth_format_size(src.depth_format)
+        );
+    }
+
+
+    Interlacer::Interlacer(PixelPattern pattern, double tolerance) {
+        this->pattern = pattern;
+        this->tolerance = tolerance;
+    }
+
+    void Interlacer::begin_frame(const Mat<4>& view_projection) {
+        this->phase = 1 - this->phase;
+        this->previous_view_projection = this->view_projection;
+        this->view_projection = view_projection;
+    }
+
+    DrawState Interlacer::draw_state(DrawState state) const {
+        state.pattern = this->pattern;
+        state.pattern_phase = this->phase;
+        return state;
+    }
+
+    void Interlacer::reset() { this->has_history = false; }
+
+    void Interlacer::reconstruct(Surface& frame) {
+        if(frame.depth == nullptr) {
+            logging::error("Interlaced frames need to have a depth buffer");
+        }
+        int width = frame.width;
+        int height = frame.height;
+        const Surface& history = this->history;
+        bool reproject = this->has_history
+            && history.width == width && history.height == height
+            && history.format == frame.format
+            && history.depth_format == frame.depth_format;
+        Mat<4> inverse = this->view_projection.inverse();
+        Mat<4> previous_inverse = this->previous_view_projection.inverse();
+        frame.mark_dirty({ 0, 0, width, height });
+        dispatch_pixel_format(frame.format, [&]<PixelFormat P>() {
+            dispatch_depth_format(frame.depth_format, [&]<DepthFormat D>() {
+                using Pixel = PixelTraits<P>;
+                using Depth = DepthTraits<D>;
+                using Stored = typename Pixel::Stored;
+                Stored* color = (Stored*) frame.color;
+                const Stored* history_color = (const Stored*) history.color;
+                const typename Depth::Stored* depth
+                    = (const typename Depth::Stored*) frame.depth;
+                const typename Depth::Stored* history_depth
+                    = (const typename Depth::Stored*) history.depth;
+                // neighbors are averaged in linear space
+                auto load = [&](Stored stored) {
+                    if constexpr (P == PixelFormat::RGBA8) {
+                        if(frame.srgb) {
+                            float linear[4];
+                            conversion::unpack_srgb8(&stored, linear, 1);
+                            return Vec<4>(linear[0], linear[1], linear[2], linear[3]);
+                        }
+                    }
+                    return Pixel::decode(stored);
+                };
+                auto store = [&](const Vec<4>& value) {
+                    if constexpr (P == PixelFormat::RGBA8) {
+                        if(frame.srgb) {
+                            float linear[4] = {
+                                (float) value.r(), (float) value.g(),
+                                (float) value.b(), (float) value.a()
+                            };
+                            Stored encoded;
+                            conversion::pack_srgb8(linear, &encoded, 1);
+                            return encoded;
+                        }
+                    }
+                    return Pixel::encode(value);
+                };
+                auto from_history = [&](int x, int y, Stored& result) {
+                    double px_depth = Depth::decode(depth[(size_t) y * frame.pitch + x]);
+                    Vec<3> point = unproject(inverse, x, y, px_depth, width, height);
+                    Vec<2> previous;
+                    double distance;
+                    bool visible = project(
+                        this->previous_view_projection, point, width, height,
+                        previous, distance
+                    );
+                    if(!visible) { return false; }
+                    int previous_x = (int) std::round(previous.x());
+                    int previous_y = (int) std::round(previous.y());
+                    bool inside = previous_x >= 0 && previous_x < width
+                        && previous_y >= 0 && previous_y < height;
+                    if(!inside) { return false; }
+                    // reject the history if it shows a different point
+                    // (the point was hidden in the previous frame)
+                    size_t previous_i = (size_t) previous_y * history.pitch + previous_x;
+                    Vec<3> previous_point = unproject(
+                        previous_inverse, previous_x, previous_y,
+                        Depth::decode(history_depth[previous_i]), width, height
+                    );
+                    if((previous_point - point).len() > this->tolerance * distance) {
+                        return false;
+                    }
+                    result = history_color[previous_i];
+                    return true;
+                };
+                auto from_neighbors = [&](int x, int y) {
+                    Vec<4> sum = Vec<4>(0, 0, 0, 0);
+                    int count = 0;
+                    auto add = [&](int nx, int ny) {
+                        if(nx < 0 || nx >= width || ny < 0 || ny >= height) { return; }
+                        sum += load(color[(size_t) ny * frame.pitch + nx]);
+                        count += 1;
+                    };
+                    add(x, y - 1);
+                    add(x, y + 1);
+                    if(this->pattern == PixelPattern::CHECKERBOARD) {
+                        add(x - 1, y);
+                        add(x + 1, y);
+                    }
+                    return count == 0
+                        ? color[(size_t) y * frame.pitch + x]
+                        : store(sum / count);
+                };
+                // missing pixels only read shaded ones from 'frame',
+                // so rows can be filled in parallel
+                threading::parallel_for(height, 16, [&](size_t start, size_t end) {
+                    for(int y = (int) start; y < (int) end; y += 1) {
+                        for(int x = 0; x < width; x += 1) {
+                            if(is_shaded(this->pattern, this->phase, x, y)) {
+                                continue;
+                            }
+                            Stored result;
+                            if(!reproject || !from_history(x, y, result)) {
+                                result = from_neighbors(x, y);
+                            }
+                            color[(size_t) y * frame.pitch + x] = result;
+                        }
+                    }
+                });
+            });
+        });
+        copy_surface(frame, this->history);
+        this->has_history = true;
+    }
+
+
+
+    // the number of jitter offsets before the sequence repeats
+    #define UPSCALER_JITTER_PHASES 8
+
+    // The 'index'-th element of the Halton sequence with the given base
+    static double halton(uint32_t index, uint32_t base) {
+        double result = 0.0;
+        double fraction = 1.0;
+        for(; index > 0; index /= base) {
+            fraction /= base;
+            result += fraction * (index % base);
+        }
+        return result;
+    }
+
+    // The weights of the four samples around a position with the given
+    // fraction (from the second sample) for Catmull-Rom interpolation
+    static void catmull_rom_weights(float t, float* weights) {
+        float t2 = t * t;
+        float t3 = t2 * t;
+        weights[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+        weights[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+        weights[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+        weights[3] = 0.5f * (t3 - t2);
+    }
+
+    // The lowest (in 'bounds[0..3]') and highest (in 'bounds[4..7]') value
+    // of each channel in the 3x3 pixels around the given one, in a buffer
+    // of RGBA float quadruples
+    static void color_bounds(
+        const float* colors, int width, int height, int x, int y, float* bounds
+    ) {
+        // (repeating the edge pixels does not change the result)
+        const float* rows[3] = {
+            colors + (size_t) std::max(y - 1, 0) * width * 4,
+            colors + (size_t) y * width * 4,
+            colors + (size_t) std::min(y + 1, height - 1) * width * 4
+        };
+        int columns[3] = {
+            std::max(x - 1, 0) * 4, x * 4, std::min(x + 1, width - 1) * 4
+        };
+    #ifdef __SSE2__
+        __m128 lowest = _mm_loadu_ps(rows[1] + columns[1]);
+        __m128 highest = lowest;
+        for(int row = 0; row < 3; row += 1) {
+            for(int column = 0; column < 3; column += 1) {
+                __m128 c = _mm_loadu_ps(rows[row] + columns[column]);
+                lowest = _mm_min_ps(lowest, c);
+                highest = _mm_max_ps(highest, c);
+            }
+        }
+        _mm_storeu_ps(bounds, lowest);
+        _mm_storeu_ps(bounds + 4, highest);
+    #else
+        for(int channel = 0; channel < 4; channel += 1) {
+            bounds[channel] = rows[1][columns[1] + channel];
+            bounds[4 + channel] = bounds[channel];
+        }
+        for(int row = 0; row < 3; row += 1) {
+            for(int column = 0; column < 3; column += 1) {
+                const float* c = rows[row] + columns[column];
+                for(int channel = 0; channel < 4; channel += 1) {
+                    bounds[channel] = std::min(bounds[channel], c[channel]);
+                    bounds[4 + channel] = std::max(bounds[4 + channel], c[channel]);
+                }
+            }
+        }
+    #endif
+    }
+
+    static Surface history_surface(int width, int height) {
+        std::vector<FloatColor> cleared(
+            (size_t) width * height, FloatColor { 0.0f, 0.0f, 0.0f, 0.0f }
+        );
+        return Surface(
+            cleared.data(), nullptr, width, height, PixelFormat::RGBA32F
+        );
+    }
+
+    TemporalUpscaler::TemporalUpscaler(
+        int output_width, int output_height, double scale,
+        double feedback, double tolerance
+    ) : history(history_surface(output_width, output_height)),
+        next_history(history_surface(output_width, output_height)) {
+        if(scale <= 0.0 || scale > 1.0) {
+            logging::error(
+                "The render scale must be larger than 0 and at most 1 "
+                    "(given was " + std::to_string(scale) + ")"
+            );
+        }
+        this->output_width = output_width;
+        this->output_height = output_height;
+        this->width = std::max(2, (int) std::round(output_width * scale));
+        this->height = std::max(2, (int) std::round(output_height * scale));
+        this->feedback = std::clamp(feedback, 0.0, 1.0);
+        this->tolerance = tolerance;
+    }
+
+    int TemporalUpscaler::render_width() const { return this->width; }
+    int TemporalUpscaler::render_height() const { return this->height; }
+
+    void TemporalUpscaler::begin_frame(const Mat<4>& view_projection) {
+        this->frame_index += 1;
+        uint32_t phase = this->frame_index % UPSCALER_JITTER_PHASES + 1;
+        this->previous_jitter_offset = this->jitter_offset;
+        this->jitter_offset = Vec<2>(
+            halton(phase, 2) - 0.5, halton(phase, 3) - 0.5
+        );
+        this->previous_view_projection = this->view_projection;
+        this->view_projection = view_projection;
+    }
+
+    Mat<4> TemporalUpscaler::jitter() const {
+        // offsets NDC x and y so that geometry moves by the jitter in
+        // render pixels (see 'ndc_to_pixel_space')
+        Mat<4> jitter = Mat<4>();
+        jitter.element(0, 3) = this->jitter_offset.x() / (this->width / 2);
+        jitter.element(1, 3) = -this->jitter_offset.y() / (this->height / 2);
+        return jitter;
+    }
+
+    void TemporalUpscaler::reset() { this->has_history = false; }
+
+    void TemporalUpscaler::resolve(const Surface& frame, Surface& output) {
+        int width = this->width;
+        int height = this->height;
+        if(frame.width != width || frame.height != height) {
+            logging::error(
+                "The frame size (" + std::to_string(frame.width) + "x"
+                    + std::to_string(frame.height)
+                    + ") does not match the render size of the upscaler ("
+                    + std::to_string(width) + "x" + std::to_string(height) + ")"
+            );
+        }
+        if(output.width != this->output_width
+            || output.height != this->output_height) {
+            logging::error(
+                "The output size (" + std::to_string(output.width) + "x"
+                    + std::to_string(output.height)
+                    + ") does not match the output size of the upscaler ("
+                    + std::to_string(this->output_width) + "x"
+                    + std::to_string(this->output_height) + ")"
+            );
+        }
+        if(frame.depth == nullptr) {
+            logging::error("Upscaled frames need to have a depth buffer");
+        }
+        // decode the frame once, as linear colors and window space depths
+        this->current.resize((size_t) width * height * 4);
+        this->depth.resize((size_t) width * height);
+        threading::parallel_for(height, 16, [&](size_t start, size_t end) {
+            for(int y = (int) start; y < (int) end; y += 1) {
+                dispatch_pixel_format(frame.format, [&]<PixelFormat P>() {
+                    const typename PixelTraits<P>::Stored* row
+                        = (const typename PixelTraits<P>::Stored*) frame.color
+                        + (size_t) y * frame.pitch;
+                    float* dest = this->current.data() + (size_t) y * width * 4;
+                    if constexpr (P == PixelFormat::RGBA8) {
+                        if(frame.srgb) {
+                            conversion::unpack_srgb8(row, dest, width);
+                        } else {
+                            conversion::unpack_rgba8(row, dest, width);
+                        }
+                        return;
+                    }
+                    for(int x = 0; x < width; x += 1) {
+                        Vec<4> c = PixelTraits<P>::decode(row[x]);
+                        float* d = dest + x * 4;
+                        d[0] = c.r(); d[1] = c.g(); d[2] = c.b(); d[3] = c.a();
+                    }
+                });
+                dispatch_depth_format(frame.depth_format, [&]<DepthFormat D>() {
+                    const typename DepthTraits<D>::Stored* row
+                        = (const typename DepthTraits<D>::Stored*) frame.depth
+                        + (size_t) y * frame.pitch;
+                    float* dest = this->depth.data() + (size_t) y * width;
+                    for(int x = 0; x < width; x += 1) {
+                        dest[x] = (float) DepthTraits<D>::decode(row[x]);
+                    }
+                });
+            }
+        });
+        bool reproject = this->has_history
+            && this->previous_distance.size() == this->depth.size();
+        Vec<2> jitter = this->jitter_offset;
+        Vec<2> previous_jitter = this->previous_jitter_offset;
+        // For each rendered pixel, find its distance to the camera, where
+        // the point it shows was in the previous frame (as an offset in
+        // render pixels, if the history is not rejected there) and the
+        // range of the colors around it
+        this->distance.resize((size_t) width * height);
+        this->motion.resize((size_t) width * height * 2);
+        this->history_valid.resize((size_t) width * height);
+        this->bounds.resize((size_t) width * height * 8);
+        Mat<4> inverse = this->view_projection.inverse();
+        Vec<4> inverse_w = inverse[3];
+        // from NDC of the current frame to clip space of the previous one
+        Mat<4> reprojection = this->previous_view_projection * inverse;
+        double half_width = width / 2;
+        double half_height = height / 2;
+        threading::parallel_for(height, 16, [&](size_t start, size_t end) {
+            for(int y = (int) start; y < (int) end; y += 1) {
+                for(int x = 0; x < width; x += 1) {
+                    size_t i = (size_t) y * width + x;
+                    // the sample has been taken at the jittered position
+                    Vec<4> ndc = pixel_to_ndc(
+                        x - jitter.x(), y - jitter.y(), this->depth[i],
+                        width, height
+                    ).with(1.0);
+                    double distance = 1.0 / inverse_w.dot(ndc);
+                    this->distance[i] = (float) distance;
+                    if(!reproject) { continue; }
+                    color_bounds(
+                        this->current.data(), width, height, x, y,
+                        this->bounds.data() + i * 8
+                    );
+                    this->history_valid[i] = 0;
+                    // (scaled by the inverse of the current distance)
+                    Vec<4> clip = reprojection * ndc;
+                    if(clip.w() <= 0.0) { continue; }
+                    // (see 'ndc_to_pixel_space')
+                    double z = clip.z() / clip.w();
+                    double previous_x = half_width * (clip.x() / clip.w() + z);
+                    double previous_y = height * z
+                        - half_height * (clip.y() / clip.w() + z);
+                    int pixel_x = (int) std::round(previous_x + previous_jitter.x());
+                    int pixel_y = (int) std::round(previous_y + previous_jitter.y());
+                    bool inside = pixel_x >= 0 && pixel_x < width
+                        && pixel_y >= 0 && pixel_y < height;
+                    if(!inside) { continue; }
+                    // reject the history if it shows a different surface
+                    // (the point was hidden in the previous frame)
+                    double previous_distance = this->previous_distance[
+                        (size_t) pixel_y * width + pixel_x
+                    ];
+                    double point_distance = clip.w() * distance;
+                    double difference = std::abs(previous_distance - point_distance);
+                    if(difference > this->tolerance * point_distance) { continue; }
+                    float* offset = this->motion.data() + i * 2;
+                    offset[0] = (float) (previous_x - (x - jitter.x()));
+                    offset[1] = (float) (previous_y - (y - jitter.y()));
+                    this->history_valid[i] = 1;
+                }
+            }
+        });
+        // render pixels per output pixel (matching 'ndc_to_pixel_space')
+        float ratio_x = (float) (width / 2) / (this->output_width / 2);
+        float ratio_y = (float) (height / 2) / (this->output_height / 2);
+        float jitter_x = (float) jitter.x();
+        float jitter_y = (float) jitter.y();
+        float current_weight = (float) (1.0 - this->feedback);
+        const float* current = this->current.data();
+        const float* history = (const float*) this->history.color;
+        size_t history_pitch = this->history.pitch * 4;
+        float* next = (float*) this->next_history.color;
+        size_t next_pitch = this->next_history.pitch * 4;
+        // bilinear filtering of a buffer of RGBA float quadruples
+        auto sample = [](
+            const float* buffer, size_t pitch, int width, int height,
+            float x, float y, float* result
+        ) {
+            x = std::clamp(x, 0.0f, width - 1.0f);
+            y = std::clamp(y, 0.0f, height - 1.0f);
+            int x0 = std::min((int) x, std::max(width - 2, 0));
+            int y0 = std::min((int) y, std::max(height - 2, 0));
+            int x1 = std::min(x0 + 1, width - 1);
+            int y1 = std::min(y0 + 1, height - 1);
+            float tx = x - x0;
+            float ty = y - y0;
+            const float* a = buffer + y0 * pitch + x0 * 4;
+            const float* b = buffer + y0 * pitch + x1 * 4;
+            const float* c = buffer + y1 * pitch + x0 * 4;
+            const float* d = buffer + y1 * pitch + x1 * 4;
+            for(int channel = 0; channel < 4; channel += 1) {
+                float top = a[channel] + (b[channel] - a[channel]) * tx;
+                float bottom = c[channel] + (d[channel] - c[channel]) * tx;
+                result[channel] = top + (bottom - top) * ty;
+            }
+        };
+        // Catmull-Rom filtering of the history, which (unlike bilinear
+        // filtering) does not blur it further each time it is reprojected.
+        // The corner samples have the smallest weights and are skipped.
+        auto sample_history = [&](float x, float y, float* result) {
+            int last_x = this->output_width - 1;
+            int last_y = this->output_height - 1;
+            x = std::clamp(x, 0.0f, (float) last_x);
+            y = std::clamp(y, 0.0f, (float) last_y);
+            int x1 = (int) x;
+            int y1 = (int) y;
+            float weights_x[4];
+            float weights_y[4];
+            catmull_rom_weights(x - x1, weights_x);
+            catmull_rom_weights(y - y1, weights_y);
+            float corners = (weights_x[0] + weights_x[3])
+                * (weights_y[0] + weights_y[3]);
+            float normalization = 1.0f / (1.0f - corners);
+            int columns[4];
+            for(int i = 0; i < 4; i += 1) {
+                columns[i] = std::clamp(x1 - 1 + i, 0, last_x) * 4;
+            }
+        #ifdef __SSE2__
+            __m128 sum = _mm_setzero_ps();
+        #else
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        #endif
+            for(int j = 0; j < 4; j += 1) {
+                const float* row = history
+                    + std::clamp(y1 - 1 + j, 0, last_y) * history_pitch;
+                bool outer = j == 0 || j == 3;
+                for(int i = outer ? 1 : 0; i < (outer ? 3 : 4); i += 1) {
+                    float weight = weights_x[i] * weights_y[j] * normalization;
+                    const float* c = row + columns[i];
+                #ifdef __SSE2__
+                    sum = _mm_add_ps(sum, _mm_mul_ps(
+                        _mm_loadu_ps(c), _mm_set1_ps(weight)
+                    ));
+                #else
+                    for(int channel = 0; channel < 4; channel += 1) {
+                        sum[channel] += c[channel] * weight;
+                    }
+                #endif
+                }
+            }
+        #ifdef __SSE2__
+            _mm_storeu_ps(result, sum);
+        #else
+            for(int channel = 0; channel < 4; channel += 1) {
+                result[channel] = sum[channel];
+            }
+        #endif
+        };
+        // The nearest rendered pixel of each output column, and how much it
+        // counts (samples closer to the output pixel count more). Output
+        // pixel x is at 'x * ratio_x' in the render pixels of the
+        // unjittered frame.
+        this->column_pixels.resize(this->output_width);
+        this->column_weights.resize(this->output_width);
+        for(int ox = 0; ox < this->output_width; ox += 1) {
+            float ux = ox * ratio_x;
+            int rx = std::clamp((int) std::lround(ux + jitter_x), 0, width - 1);
+            float dx = (rx - jitter_x - ux) / ratio_x;
+            this->column_pixels[ox] = rx;
+            this->column_weights[ox] = std::exp(-2.0f * dx * dx);
+        }
+        threading::parallel_for(this->output_height, 16, [&](size_t start, size_t end) {
+            for(int oy = (int) start; oy < (int) end; oy += 1) {
+                float* dest_row = next + oy * next_pitch;
+                float uy = oy * ratio_y;
+                int ry = std::clamp((int) std::lround(uy + jitter_y), 0, height - 1);
+                float dy = (ry - jitter_y - uy) / ratio_y;
+                float row_weight = current_weight * std::exp(-2.0f * dy * dy);
+                for(int ox = 0; ox < this->output_width; ox += 1) {
+                    float* dest = dest_row + ox * 4;
+                    float ux = ox * ratio_x;
+                    size_t i = (size_t) ry * width + this->column_pixels[ox];
+                    if(!reproject || !this->history_valid[i]) {
+                        sample(
+                            current, (size_t) width * 4, width, height,
+                            ux + jitter_x, uy + jitter_y, dest
+                        );
+                        continue;
+                    }
+                    const float* offset = this->motion.data() + i * 2;
+                    float past[4];
+                    sample_history(
+                        (ux + offset[0]) / ratio_x, (uy + offset[1]) / ratio_y,
+                        past
+                    );
+                    float alpha = row_weight * this->column_weights[ox];
+                    const float* range = this->bounds.data() + i * 8;
+                    const float* rendered = current + i * 4;
+                    for(int channel = 0; channel < 4; channel += 1) {
+                        float clamped = std::clamp(
+                            past[channel], range[channel], range[4 + channel]
+                        );
+                        dest[channel] = clamped
+                            + (rendered[channel] - clamped) * alpha;
+                    }
+                }
+            }
+        });
+        std::swap(this->history, this->next_history);
+        this->previous_distance.swap(this->distance);
+        this->has_history = true;
+        // write the new history to the output
+        output.mark_dirty({ 0, 0, output.width, output.height });
+        const FloatColor* resolved = (const FloatColor*) this->history.color;
+        threading::parallel_for(output.height, 16, [&](size_t start, size_t end) {
+            for(size_t y = start; y < end; y += 1) {
+                const float* src = (const float*) (resolved + y * this->history.pitch);
+                dispatch_pixel_format(output.format, [&]<PixelFormat P>() {
+                    typename PixelTraits<P>::Stored* row
+                        = (typename PixelTraits<P>::Stored*) output.color
+                        + y * output.pitch;
+                    if constexpr (P == PixelFormat::RGBA8) {
+                        if(output.srgb) {
+                            conversion::pack_srgb8(src, row, output.width);
+                        } else {
+                            conversion::pack_rgba8(src, row, output.width);
+                        }
+                        return;
+                    }
+                    for(int x = 0; x < output.width; x += 1) {
+                        const float* c = src + x * 4;
+                        row[x] = PixelTraits<P>::encode(
+                            Vec<4>(c[0], c[1], c[2], c[3])
+                        );
+                    }
+                });
+            }
+        });
+    }
+
+}
@@ -0,0 +1,126 @@
+
+#include <druck/threading.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+namespace druck::threading {
+
+    struct Pool {
+        std::vector<std::thread> workers;
+        std::mutex submit_lock; // held by the thread that owns the current job
+        std::mutex lock;
+        std::condition_variable job_started;
+        std::condition_variable job_finished;
+        bool stopping = false;
+        uint64_t generation = 0;
+        // the current job
+        const std::function<void(size_t, size_t)>* job = nullptr;
+        size_t count = 0;
+        size_t chunk_size = 0;
+        std::atomic<size_t> next_chunk = 0;
+        // every worker takes part in every job (even if no chunks are left),
+        // which makes sure no worker still reads the job once it returns
+        size_t finished_workers = 0;
+
+        Pool() {
+            size_t hardware = std::thread::hardware_concurrency();
+            size_t worker_count = hardware > 1 ? hardware - 1 : 0;
+            for(size_t i = 0; i < worker_count; i += 1) {
+                this->workers.push_back(std::thread([this]() { this->work(); }));
+            }
+        }
+
+        ~Pool() {
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                this->stopping = true;
+            }
+            this->job_started.notify_all();
+            for(std::thread& worker: this->workers) { worker.join(); }
+        }
+
+        void run_chunks() {
+            size_t chunk_count = (this->count + this->chunk_size - 1)
+                / this->chunk_size;
+            for(;;) {
+                size_t chunk_i = this->next_chunk.fetch_add(1);
+                if(chunk_i >= chunk_count) { return; }
+                size_t start = chunk_i * this->chunk_size;
+                size_t end = std::min(start + this->chunk_size, this->count);
+                (*this->job)(start, end);
+            }
+        }
+
+        void work() {
+            uint64_t seen_generation = 0;
+            for(;;) {
+                {
+                    std::unique_lock<std::mutex> guard(this->lock);
+                    this->job_started.wait(guard, [&]() {
+                        return this->stopping
+                            || this->generation != seen_generation;
+                    });
+                    if(this->stopping) { return; }
+                    seen_generation = this->generation;
+                }
+                this->run_chunks();
+                {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    this->finished_workers += 1;
+                }
+                this->job_finished.notify_all();
+            }
+        }
+    };
+
+    static Pool& get_pool() {
+        static Pool pool;
+        return pool;
+    }
+
+    size_t thread_count() {
+        return get_pool().workers.size() + 1;
+    }
+
+    void parallel_for(
+        size_t count, size_t min_chunk,
+        const std::function<void(size_t, size_t)>& f
+    ) {
+        if(count == 0) { return; }
+        if(min_chunk == 0) { min_chunk = 1; }
+        Pool& pool = get_pool();
+        bool serial = pool.workers.size() == 0 || count <= min_chunk;
+        std::unique_lock<std::mutex> submit_guard(
+            pool.submit_lock, std::defer_lock
+        );
+        if(serial || !submit_guard.try_lock()) {
+            f(0, count);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(pool.lock);
+            pool.job = &f;
+            pool.count = count;
+            // a few chunks per thread, so that uneven chunks even out
+            size_t chunk_size = count / (thread_count() * 4);
+            pool.chunk_size = std::max(chunk_size, min_chunk);
+            pool.next_chunk = 0;
+            pool.finished_workers = 0;
+            pool.generation += 1;
+        }
+        pool.job_started.notify_all();
+        pool.run_chunks();
+        // wait for all workers to be done with this job
+        std::unique_lock<std::mutex> guard(pool.lock);
+        pool.job_finished.wait(guard, [&]() {
+            return pool.finished_workers == pool.workers.size();
+        });
+        pool.job = nullptr;
+    }
+
+}
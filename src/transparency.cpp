@@ -0,0 +1,139 @@
+
+#include <druck/transparency.hpp>
+#include <druck/conversion.hpp>
+#include <druck/logging.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace druck::rendering {
+
+    namespace logging = druck::logging;
+
+
+    double transparency_weight(double depth, double alpha) {
+        // McGuire and Bavoil 2013, with the depth in window space
+        double distance = 1.0 - depth;
+        return alpha * std::clamp(
+            3e3 * distance * distance * distance, 1e-2, 3e3
+        );
+    }
+
+    TransparencyBuffer::TransparencyBuffer(int width, int height)
+        : accum(width, height, PixelFormat::RGBA32F),
+        revealage(width, height, PixelFormat::RGBA32F) {
+        this->covered = { 0, 0, width, height };
+        this->clear();
+    }
+
+    int TransparencyBuffer::width() const { return this->accum.width; }
+    int TransparencyBuffer::height() const { return this->accum.height; }
+
+    void TransparencyBuffer::resize(int width, int height) {
+        this->accum.resize(width, height);
+        this->revealage.resize(width, height);
+        this->covered = { 0, 0, width, height };
+        this->clear();
+    }
+
+    void TransparencyBuffer::clear() {
+        // only the area that has been drawn to needs to be reset
+        const Rect& area = this->covered;
+        for(int y = area.y; y < area.y + area.height; y += 1) {
+            FloatColor* accum = (FloatColor*) this->accum.color
+                + (size_t) y * this->accum.pitch;
+            FloatColor* revealage = (FloatColor*) this->revealage.color
+                + (size_t) y * this->revealage.pitch;
+            std::fill(
+                accum + area.x, accum + area.x + area.width,
+                FloatColor { 0.0f, 0.0f, 0.0f, 0.0f }
+            );
+            std::fill(
+                revealage + area.x, revealage + area.x + area.width,
+                FloatColor { 1.0f, 0.0f, 0.0f, 0.0f }
+            );
+        }
+        this->covered = Rect();
+    }
+
+    void TransparencyBuffer::verify_size(
+        const Surface& surface, const std::string& name
+    ) const {
+        if(surface.width == this->width() && surface.height == this->height()) {
+            return;
+        }
+        logging::error(
+            "The size of the " + name + " (" + std::to_string(surface.width)
+                + "x" + std::to_string(surface.height)
+                + ") does not match the size of the transparency buffer ("
+                + std::to_string(this->width()) + "x"
+                + std::to_string(this->height()) + ")"
+        );
+    }
+
+    void TransparencyBuffer::resolve(Surface& target) const {
+        this->verify_size(target, "target");
+        const Rect& area = this->covered;
+        if(area.is_empty()) { return; }
+        target.mark_dirty(area);
+        threading::parallel_for(area.height, 16, [&](size_t start, size_t end) {
+            // the averaged color and coverage of each pixel, which is then
+            // blended over the target like any other fragment
+            float src[SURFACE_SPAN_SIZE * 4];
+            for(size_t row_i = start; row_i < end; row_i += 1) {
+                int y = area.y + (int) row_i;
+                const FloatColor* accum = (const FloatColor*) this->accum.color
+                    + (size_t) y * this->accum.pitch;
+                const FloatColor* revealage
+                    = (const FloatColor*) this->revealage.color
+                    + (size_t) y * this->revealage.pitch;
+                for(int span_x = area.x; span_x < area.x + area.width;
+                    span_x += SURFACE_SPAN_SIZE) {
+                    size_t length = (size_t) std::min(
+                        SURFACE_SPAN_SIZE, area.x + area.width - span_x
+                    );
+                    for(size_t i = 0; i < length; i += 1) {
+                        const FloatColor& sum = accum[span_x + i];
+                        float weight = std::max(sum.a, 1e-5f);
+                        float* s = src + i * 4;
+                        s[0] = sum.r / weight;
+                        s[1] = sum.g / weight;
+                        s[2] = sum.b / weight;
+                        s[3] = 1.0f - revealage[span_x + i].r;
+                    }
+                    dispatch_pixel_format(target.format, [&]<PixelFormat P>() {
+                        using Stored = typename PixelTraits<P>::Stored;
+                        Stored* row = (Stored*) target.color
+                            + (size_t) y * target.pitch + span_x;
+                        if constexpr (P == PixelFormat::RGBA8) {
+                            Color packed[SURFACE_SPAN_SIZE];
+                            if(!target.srgb) {
+                                conversion::pack_rgba8(src, packed, length);
+                                blending::blend_rgba8(
+                                    blending::Mode::ALPHA, packed, row, length
+                                );
+                                return;
+                            }
+                            // blend in linear space
+                            float dest[SURFACE_SPAN_SIZE * 4];
+                            conversion::unpack_srgb8(row, dest, length);
+                            blending::blend_floats(
+                                blending::Mode::ALPHA, src, dest, length
+                            );
+                            conversion::pack_srgb8(dest, row, length);
+                            return;
+                        }
+                        for(size_t i = 0; i < length; i += 1) {
+                            const float* s = src + i * 4;
+                            row[i] = PixelTraits<P>::encode(blending::blend(
+                                blending::Mode::ALPHA,
+                                Vec<4>(s[0], s[1], s[2], s[3]),
+                                PixelTraits<P>::decode(row[i])
+                            ));
+                        }
+                    });
+                }
+            }
+        });
+    }
+
+}
@@ -0,0 +1,184 @@
+
+#include <druck/video.hpp>
+#include <druck/conversion.hpp>
+#include <druck/logging.hpp>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+
+namespace druck::video {
+
+    namespace logging = druck::logging;
+
+
+    Sink::Sink(
+        const char* file, int width, int height, int fps, Format format,
+        size_t max_queued
+    ) {
+        this->output = std::fopen(file, "wb");
+        if(this->output == nullptr) {
+            logging::error(
+                "The file '" + std::string(file) + "' could not be opened"
+            );
+        }
+        this->width = width;
+        this->height = height;
+        this->format = format;
+        this->start(fps, max_queued);
+    }
+
+    Sink::Sink(
+        int file_descriptor, int width, int height, int fps, Format format,
+        size_t max_queued
+    ) {
+        this->output = fdopen(file_descriptor, "wb");
+        if(this->output == nullptr) {
+            logging::error(
+                "The file descriptor " + std::to_string(file_descriptor)
+                    + " could not be opened"
+            );
+        }
+        this->width = width;
+        this->height = height;
+        this->format = format;
+        this->start(fps, max_queued);
+    }
+
+    Sink::~Sink() {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->frame_queued.notify_all();
+        this->thread.join();
+        std::fclose(this->output);
+    }
+
+    void Sink::start(int fps, size_t max_queued) {
+        this->max_queued = std::max(max_queued, (size_t) 1);
+        if(this->format == Format::Y4M) {
+            std::string header = "YUV4MPEG2 W" + std::to_string(this->width)
+                + " H" + std::to_string(this->height)
+                + " F" + std::to_string(fps) + ":1"
+                + " Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n";
+            std::fwrite(header.data(), 1, header.size(), this->output);
+        }
+        this->thread = std::thread([this]() { this->run(); });
+    }
+
+    bool Sink::write_frame(const rendering::Surface& frame) {
+        if(frame.width != this->width || frame.height != this->height) {
+            logging::error(
+                "The frame size (" + std::to_string(frame.width) + "x"
+                    + std::to_string(frame.height)
+                    + ") does not match the size of the video ("
+                    + std::to_string(this->width) + "x"
+                    + std::to_string(this->height) + ")"
+            );
+        }
+        std::vector<rendering::Color> pixels;
+        bool failed;
+        bool full = false;
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            failed = this->failed;
+            if(!failed && this->queue.size() + this->reserved >= this->max_queued) {
+                full = true;
+            } else if(!failed) {
+                // (keeps the slot while the frame is copied)
+                this->reserved += 1;
+                if(this->free_frames.size() > 0) {
+                    pixels = std::move(this->free_frames.back());
+                    this->free_frames.pop_back();
+                }
+            }
+        }
+        if(failed) { return false; }
+        if(full) {
+            logging::warning(
+                "Too many video frames are already queued, a frame is dropped"
+            );
+            return false;
+        }
+        pixels.resize((size_t) this->width * this->height);
+        frame.read_colors(pixels.data());
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->reserved -= 1;
+            this->queue.push_back(std::move(pixels));
+        }
+        this->frame_queued.notify_one();
+        return true;
+    }
+
+    bool Sink::flush() {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->frame_written.wait(guard, [&]() {
+            return this->queue.size() == 0 && !this->writing;
+        });
+        if(this->failed) { return false; }
+        return std::fflush(this->output) == 0;
+    }
+
+    size_t Sink::queued_frames() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->queue.size() + this->reserved + (this->writing ? 1 : 0);
+    }
+
+    void Sink::run() {
+        size_t luma_size = (size_t) this->width * this->height;
+        size_t chroma_size = (size_t) ((this->width + 1) / 2)
+            * ((this->height + 1) / 2);
+        std::vector<uint8_t> planes;
+        if(this->format == Format::Y4M) {
+            planes.resize(luma_size + chroma_size * 2);
+        }
+        for(;;) {
+            std::vector<rendering::Color> pixels;
+            bool failed;
+            {
+                std::unique_lock<std::mutex> guard(this->lock);
+                this->frame_queued.wait(guard, [&]() {
+                    return this->stopping || this->queue.size() > 0;
+                });
+                if(this->queue.size() == 0) { return; }
+                pixels = std::move(this->queue.front());
+                this->queue.pop_front();
+                this->writing = true;
+                failed = this->failed;
+            }
+            bool written = false;
+            if(failed) {
+                // (frames queued before the failure are discarded)
+            } else if(this->format == Format::Y4M) {
+                uint8_t* y = planes.data();
+                uint8_t* u = y + luma_size;
+                uint8_t* v = u + chroma_size;
+                conversion::rgba8_to_yuv420(
+                    pixels.data(), this->width, this->height, y, u, v
+                );
+                written = std::fwrite("FRAME\n", 1, 6, this->output) == 6
+                    && std::fwrite(planes.data(), 1, planes.size(), this->output)
+                        == planes.size();
+            } else {
+                size_t size = pixels.size() * sizeof(rendering::Color);
+                written = std::fwrite(pixels.data(), 1, size, this->output)
+                    == size;
+            }
+            if(!written && !failed) {
+                logging::warning(
+                    "A video frame could not be written, no further frames "
+                        "will be written"
+                );
+            }
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                if(!written) { this->failed = true; }
+                this->free_frames.push_back(std::move(pixels));
+                this->writing = false;
+            }
+            this->frame_written.notify_all();
+        }
+    }
+
+}
@@ -1,8 +1,13 @@
 
+#ifndef DRUCK_HEADLESS
+
 #include <druck/window.hpp>
 #include <druck/logging.hpp>
+#include <raylib.h>
 #include <cstdlib>
+#include <cstring>
 #include <utility>
+#include <vector>
 
 namespace druck::window {
 
@@ -27,23 +32,143 @@ namespace druck::window {
 
     double delta_time() { return GetFrameTime(); }
 
-    void display_buffer(rendering::Surface& buffer) {
+    static std::vector<rendering::Color> converted;
+
+    // Returns the raylib pixel format matching the given one,
+    // or -1 if raylib does not support it
+    static int raylib_pixel_format(rendering::PixelFormat format) {
+        switch(format) {
+            case rendering::PixelFormat::RGBA8:
+                return PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+            case rendering::PixelFormat::RGB565:
+                return PIXELFORMAT_UNCOMPRESSED_R5G6B5;
+            case rendering::PixelFormat::R8:
+                return PIXELFORMAT_UNCOMPRESSED_GRAYSCALE;
+            case rendering::PixelFormat::RGBA32F:
+                return PIXELFORMAT_UNCOMPRESSED_R32G32B32A32;
+            default:
+                return -1;
+        }
+    }
+
+    // The texture the buffer is uploaded to, which is only recreated
+    // if the size or format of the displayed buffer changes
+    static Texture2D texture;
+    static bool has_texture = false;
+    // the generation of the buffer the texture currently shows, so that
+    // only its dirty area needs to be uploaded when it is displayed again
+    static uint64_t uploaded_generation = 0;
+    static std::vector<uint8_t> staging;
+
+    // Natively supported buffers are uploaded including the padding of their
+    // rows (only the actual width of the texture is drawn), so that they
+    // don't need to be copied
+    static int texture_width(const rendering::Surface& buffer) {
+        if(raylib_pixel_format(buffer.format) == -1) { return buffer.width; }
+        return buffer.pitch;
+    }
+
+    static void upload_full(rendering::Surface& buffer, int format) {
         Image img;
         img.data = buffer.color;
-        img.width = buffer.width;
+        img.width = texture_width(buffer);
         img.height = buffer.height;
-        img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+        img.format = format;
         img.mipmaps = 1;
-        Texture2D texture = LoadTextureFromImage(img);
+        if(raylib_pixel_format(buffer.format) == -1) {
+            converted.resize(buffer.width * buffer.height);
+            buffer.read_colors(converted.data());
+            img.data = converted.data();
+        }
+        bool matches = has_texture
+            && texture.width == img.width
+            && texture.height == img.height
+            && texture.format == img.format;
+        if(matches) {
+            UpdateTexture(texture, img.data);
+            return;
+        }
+        if(has_texture) { UnloadTexture(texture); }
+        texture = LoadTextureFromImage(img);
+        has_texture = true;
+    }
+
+    static void upload_area(rendering::Surface& buffer, rendering::Rect area) {
+        Rectangle rect = {
+            (float) area.x, (float) area.y,
+            (float) area.width, (float) area.height
+        };
+        if(raylib_pixel_format(buffer.format) == -1) {
+            converted.resize(area.width * area.height);
+            buffer.read_colors(converted.data(), area);
+            UpdateTextureRec(texture, rect, converted.data());
+            return;
+        }
+        size_t pixel_size = rendering::pixel_format_size(buffer.format);
+        if(area.width == buffer.width) {
+            // whole rows (including padding) are already contiguous
+            rect.width = (float) buffer.pitch;
+            UpdateTextureRec(
+                texture, rect,
+                (uint8_t*) buffer.color + area.y * buffer.pitch * pixel_size
+            );
+            return;
+        }
+        size_t area_row_size = pixel_size * area.width;
+        staging.resize(area_row_size * area.height);
+        for(int y = 0; y < area.height; y += 1) {
+            const uint8_t* row = (const uint8_t*) buffer.color
+                + ((size_t) (area.y + y) * buffer.pitch + area.x) * pixel_size;
+            std::memcpy(staging.data() + y * area_row_size, row, area_row_size);
+        }
+        UpdateTextureRec(texture, rect, staging.data());
+    }
+
+    static void upload_buffer(rendering::Surface& buffer) {
+        int format = raylib_pixel_format(buffer.format);
+        if(format == -1) {
+            // not supported by raylib, converted to RGBA8
+            format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+        }
+        bool partial = has_texture
+            && uploaded_generation == buffer.generation
+            && texture.width == texture_width(buffer)
+            && texture.height == buffer.height
+            && texture.format == format;
+        if(!partial) {
+            upload_full(buffer, format);
+        } else if(!buffer.dirty.is_empty()) {
+            upload_area(buffer, buffer.dirty);
+        }
+        uploaded_generation = buffer.generation;
+        buffer.clear_dirty();
+    }
+
+    void display_buffer(rendering::Surface& buffer) {
+        upload_buffer(buffer);
+        Rectangle src_rect = { 
+            0.0f, 0.0f, (float) buffer.width, (float) buffer.height 
+        };
+        Rectangle dest_rect = { 
+            0.0f, 0.0f, (float) GetScreenWidth(), (float) GetScreenHeight() 
+        };
         BeginDrawing();
         ClearBackground(BLACK);
-        DrawTexture(texture, 0, 0, WHITE);
+        DrawTexturePro(
+            texture, src_rect, dest_rect, Vector2 { 0.0f, 0.0f }, 0.0f, WHITE
+        );
         EndDrawing();
-        UnloadTexture(texture);
     }
 
     void close() {
+        if(has_texture) {
+            UnloadTexture(texture);
+            has_texture = false;
+            uploaded_generation = 0;
+        }
         CloseWindow();
     }
 
 }
+
+#endif